@@ -0,0 +1,227 @@
+// Encode and decode cost of every message in protocol.cpp, of the float
+// quantisation under them and of the xor cipher. Packets go to an in-memory sink
+// instead of ENet, so no sockets are involved. Prints JSON, to keep and diff
+// when a codec changes.
+// usage: w10_bench_protocol [iterations, default 100000]
+#include "protocol.h"
+#include "messageSchema.h"
+#include "quantisation.h"
+#include "rng.h"
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+constexpr size_t numShips = 100;
+
+// keeps the optimiser from throwing away results nobody reads
+static volatile uint32_t sink;
+
+static double now_nsec()
+{
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// keeps the last packet for the decoders, frees the one before
+struct CaptureSink
+{
+  ENetPacket *packet = nullptr;
+  size_t bytes = 0;
+};
+
+static void capture_packet(void *user, ENetPeer *, uint8_t, ENetPacket *packet, bool last)
+{
+  if (!last)
+    return;
+  CaptureSink &capture = *(CaptureSink*)user;
+  capture.bytes += packet->dataLength;
+  if (capture.packet)
+    enet_packet_destroy(capture.packet);
+  capture.packet = packet;
+}
+
+struct BenchResult
+{
+  const char *name;
+  double nsPerOp;
+  double bytesPerOp;
+};
+
+static std::vector<BenchResult> results;
+static CaptureSink capture;
+static size_t iterations = 100000;
+
+// an encoder, bytes are whatever reached the sink
+template<typename Callable>
+static void bench_send(const char *name, Callable c)
+{
+  c(); // warm up
+  capture.bytes = 0;
+  const double start = now_nsec();
+  for (size_t i = 0; i < iterations; ++i)
+    c();
+  const double elapsed = now_nsec() - start;
+  results.push_back({name, elapsed / iterations, double(capture.bytes) / iterations});
+}
+
+// a decoder, run on the packet the last encoder produced
+template<typename Callable>
+static void bench_receive(const char *name, Callable c)
+{
+  ENetPacket *packet = capture.packet;
+  c(packet);
+  const double start = now_nsec();
+  for (size_t i = 0; i < iterations; ++i)
+    c(packet);
+  const double elapsed = now_nsec() - start;
+  results.push_back({name, elapsed / iterations, double(packet->dataLength)});
+}
+
+// pure functions, `c(i)` gets a different input every call
+template<typename Callable>
+static void bench_pure(const char *name, double bytes, Callable c)
+{
+  uint32_t acc = 0;
+  const double start = now_nsec();
+  for (size_t i = 0; i < iterations; ++i)
+    acc += c(i);
+  const double elapsed = now_nsec() - start;
+  sink = acc;
+  results.push_back({name, elapsed / iterations, bytes});
+}
+
+static void print_json()
+{
+  printf("{\n  \"bench\": \"w10_protocol\",\n  \"iterations\": %zu,\n  \"results\": [\n", iterations);
+  for (size_t i = 0; i < results.size(); ++i)
+    printf("    {\"name\": \"%s\", \"ns_per_op\": %.2f, \"bytes_per_op\": %.2f}%s\n", results[i].name,
+           results[i].nsPerOp, results[i].bytesPerOp, i + 1 < results.size() ? "," : "");
+  printf("  ]\n}\n");
+}
+
+static void bench_messages()
+{
+  Rng rng(1);
+  ENetPeer peer = {};
+  uint32_t peerKey = rng.next();
+  peer.data = &peerKey;
+
+  Entity ship;
+  ship.color = rng.next();
+  ship.x = rng.uniform(-16.f, 16.f);
+  ship.y = rng.uniform(-8.f, 8.f);
+  ship.speed = 3.f;
+  ship.ori = rng.uniform(-PI, PI);
+  ship.thr = 1.f;
+  ship.eid = 7;
+
+  bench_send("send_join", [&]() { send_join(&peer); });
+
+  bench_send("send_new_entity", [&]() { send_new_entity(&peer, ship); });
+  bench_receive("deserialize_new_entity", [](ENetPacket *packet)
+  {
+    Entity e;
+    deserialize_new_entity(packet, e);
+    sink = e.eid;
+  });
+
+  bench_send("send_set_controlled_entity", [&]() { send_set_controlled_entity(&peer, ship.eid); });
+  bench_receive("deserialize_set_controlled_entity", [](ENetPacket *packet)
+  {
+    uint16_t eid;
+    deserialize_set_controlled_entity(packet, eid);
+    sink = eid;
+  });
+
+  bench_send("send_cipher_key", [&]() { send_cipher_key(&peer, peerKey); });
+  bench_receive("deserialize_and_set_key", [](ENetPacket *packet) { deserialize_and_set_key(packet); });
+
+  // fuzzed and ciphered on the way out, the decoder reads garbage at the same cost
+  bench_send("send_entity_input", [&]() { send_entity_input(&peer, ship.eid, 1.f, -1.f); });
+  bench_receive("deserialize_entity_input", [](ENetPacket *packet)
+  {
+    uint16_t eid;
+    float thr, steer;
+    deserialize_entity_input(packet, eid, thr, steer);
+    sink = eid;
+  });
+  // twice per call, so the packet ends up as it was
+  bench_receive("xor_packet_data_input", [&](ENetPacket *packet)
+  {
+    xor_packet_data(packet, (uint8_t*)&peerKey);
+    xor_packet_data(packet, (uint8_t*)&peerKey);
+  });
+  results.back().nsPerOp *= 0.5;
+
+  bench_send("send_snapshot", [&]() { send_snapshot(&peer, ship.eid, ship.x, ship.y, ship.ori); });
+  bench_receive("deserialize_snapshot", [](ENetPacket *packet)
+  {
+    uint16_t eid;
+    float x, y, ori;
+    deserialize_snapshot(packet, eid, x, y, ori);
+    sink = eid;
+  });
+
+  std::vector<EntitySnapshot> snapshots(numShips);
+  for (size_t i = 0; i < snapshots.size(); ++i)
+    snapshots[i] = {uint16_t(i), rng.uniform(-16.f, 16.f), rng.uniform(-8.f, 8.f), rng.uniform(-PI, PI)};
+  bench_send("send_world_snapshot_100", [&]() { send_world_snapshot(&peer, snapshots); });
+  std::vector<EntitySnapshot> received;
+  bench_receive("deserialize_world_snapshot_100", [&](ENetPacket *packet)
+  {
+    deserialize_world_snapshot(packet, received);
+    sink = uint32_t(received.size());
+  });
+  bench_receive("xor_packet_data_world_snapshot_100", [&](ENetPacket *packet)
+  {
+    xor_packet_data(packet, (uint8_t*)&peerKey);
+    xor_packet_data(packet, (uint8_t*)&peerKey);
+  });
+  results.back().nsPerOp *= 0.5;
+
+  bench_receive("get_packet_type", [](ENetPacket *packet) { sink = get_packet_type(packet); });
+}
+
+static void bench_quantisation()
+{
+  std::vector<float> values(1024);
+  Rng rng(2);
+  for (float &v : values)
+    v = rng.uniform(-16.f, 16.f);
+  const size_t mask = values.size() - 1;
+
+  bench_pure("pack_float_11", 11 / 8.0, [&](size_t i)
+  {
+    return uint32_t(pack_float<uint16_t>(values[i & mask], -16.f, 16.f, 11));
+  });
+  bench_pure("unpack_float_11", 11 / 8.0, [&](size_t i)
+  {
+    return uint32_t(unpack_float<uint16_t>(uint16_t(i & 2047), -16.f, 16.f, 11) > 0.f);
+  });
+  bench_pure("PackedFloat_4_round_trip", 0.5, [&](size_t i)
+  {
+    float4bitsQuantized packed(values[i & mask] / 16.f, -1.f, 1.f);
+    return uint32_t(packed.unpack(-1.f, 1.f) > 0.f);
+  });
+}
+
+int main(int argc, const char **argv)
+{
+  if (argc > 1)
+    iterations = std::max(1, atoi(argv[1]));
+  if (enet_initialize() != 0)
+  {
+    printf("Cannot init ENet");
+    return 1;
+  }
+  packetSink = {capture_packet, &capture};
+  bench_messages();
+  bench_quantisation();
+  print_json();
+
+  if (capture.packet)
+    enet_packet_destroy(capture.packet);
+  atexit(enet_deinitialize);
+  return 0;
+}
@@ -0,0 +1,155 @@
+// Records a few seconds of moving ships into an EntityHistory and checks that
+// rewinding puts every ship exactly where it was, halfway ticks land in between,
+// ships spawned later and forgotten ticks are left alone and restore brings the
+// present back bit for bit. Exits with 1 on the first mismatch.
+#include "entityHistory.h"
+#include "entity.h"
+#include "mathUtils.h"
+#include "rng.h"
+#include <vector>
+#include <math.h>
+#include <stdio.h>
+
+constexpr size_t numShips = 200;
+constexpr size_t historyTicks = 64;
+constexpr uint32_t numTicks = 300;
+// spawned after most of the history was recorded
+constexpr uint16_t lateEid = 1000;
+constexpr uint32_t lateSpawnTick = numTicks - 10;
+
+struct Positions
+{
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<float> ori;
+};
+
+static Positions positions_of(const std::vector<Entity> &entities)
+{
+  Positions p;
+  for (const Entity &e : entities)
+  {
+    p.x.push_back(e.x);
+    p.y.push_back(e.y);
+    p.ori.push_back(e.ori);
+  }
+  return p;
+}
+
+static bool same_position(const std::vector<Entity> &entities, size_t i, const Positions &p, size_t j)
+{
+  return entities[i].x == p.x[j] && entities[i].y == p.y[j] && entities[i].ori == p.ori[j];
+}
+
+static bool near(float a, float b)
+{
+  return fabsf(a - b) < 1e-3f;
+}
+
+int main()
+{
+  std::vector<Entity> entities;
+  Rng rng(1);
+  for (size_t i = 0; i < numShips; ++i)
+  {
+    Entity e;
+    e.x = rng.uniform(-16.f, 16.f);
+    e.y = rng.uniform(-8.f, 8.f);
+    e.ori = rng.uniform(-PI, PI);
+    e.speed = rng.uniform(0.f, 5.f);
+    e.thr = 1.f;
+    e.steer = float(int(rng.below(3)) - 1);
+    e.eid = uint16_t(i);
+    entities.push_back(e);
+  }
+
+  EntityHistory history(historyTicks, numShips + 1, 0.f);
+  // what the world looked like at every tick, indexed by tick
+  std::vector<Positions> recorded;
+  for (uint32_t tick = 0; tick < numTicks; ++tick)
+  {
+    if (tick == lateSpawnTick)
+    {
+      Entity e;
+      e.eid = lateEid;
+      entities.push_back(e);
+    }
+    for (Entity &e : entities)
+      simulate_entity(e, 1.f / 60.f);
+    history.record(tick, entities);
+    recorded.push_back(positions_of(entities));
+  }
+  const Positions present = positions_of(entities);
+  const uint32_t newest = numTicks - 1;
+  size_t failures = 0;
+
+  auto check_restored = [&](const char *what)
+  {
+    for (size_t i = 0; i < entities.size(); ++i)
+      if (!same_position(entities, i, present, i))
+      {
+        printf("FAILED: %s didn't bring back the present, eid %u\n", what, entities[i].eid);
+        ++failures;
+        return;
+      }
+  };
+
+  for (uint32_t back : {0u, 1u, 5u, 20u, uint32_t(historyTicks - 1)})
+  {
+    const uint32_t tick = newest - back;
+    if (!history.rewind(tick, entities))
+    {
+      printf("FAILED: tick %u should still be remembered\n", tick);
+      ++failures;
+      continue;
+    }
+    for (size_t i = 0; i < numShips; ++i)
+      if (!same_position(entities, i, recorded[tick], i))
+      {
+        printf("FAILED: eid %u at tick %u is not where it was recorded\n", entities[i].eid, tick);
+        ++failures;
+        break;
+      }
+    // didn't exist yet, stays in the present
+    if (tick < lateSpawnTick && !same_position(entities, numShips, present, numShips))
+    {
+      printf("FAILED: eid %u was moved to tick %u before it existed\n", lateEid, tick);
+      ++failures;
+    }
+    history.restore(entities);
+    check_restored("restore");
+  }
+
+  // halfway between two ticks
+  const uint32_t from = newest - 10;
+  history.with_world_at(from + 0.5, entities, [&]()
+  {
+    const Positions &a = recorded[from];
+    const Positions &b = recorded[from + 1];
+    for (size_t i = 0; i < numShips; ++i)
+    {
+      const float x = (a.x[i] + b.x[i]) * 0.5f;
+      const float y = (a.y[i] + b.y[i]) * 0.5f;
+      const float ori = wrap_delta(a.ori[i] + wrap_delta(b.ori[i] - a.ori[i], PI) * 0.5f, PI);
+      if (!near(entities[i].x, x) || !near(entities[i].y, y) || fabsf(wrap_delta(entities[i].ori - ori, PI)) > 1e-3f)
+      {
+        printf("FAILED: eid %u at tick %.1f is not halfway\n", entities[i].eid, from + 0.5);
+        ++failures;
+        break;
+      }
+    }
+  });
+  check_restored("with_world_at");
+
+  // forgotten, nothing may move
+  if (history.rewind(newest - historyTicks, entities))
+  {
+    printf("FAILED: tick %u should have been forgotten\n", uint32_t(newest - historyTicks));
+    ++failures;
+  }
+  check_restored("a failed rewind");
+
+  if (failures == 0)
+    printf("entity history: %zu ticks of %zu ships rewound and restored\n", historyTicks, numShips);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,113 @@
+#pragma once
+#include <cstdint>
+#include <enet/enet.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#endif
+
+// Puts the server to sleep until a datagram arrives on the host's socket or the
+// next tick is due, whichever comes first. On Linux the socket sits in an epoll
+// set next to a timerfd, which wakes up with nanosecond precision where
+// epoll_wait's own timeout only does milliseconds. Elsewhere, or if the fds
+// can't be created, it falls back to ENet's millisecond socket wait.
+// Another thread can cut the wait short with notify(), e.g. when it has
+// queued up packets for the host.
+struct EventLoop
+{
+  ENetHost *host;
+#ifdef __linux__
+  int epollFd = -1;
+  int timerFd = -1;
+  int notifyFd = -1;
+#endif
+
+  explicit EventLoop(ENetHost *host) : host(host)
+  {
+#ifdef __linux__
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    notifyFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epollFd < 0 || timerFd < 0)
+      return;
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = host->socket;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, host->socket, &ev);
+    ev.data.fd = timerFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, timerFd, &ev);
+    if (notifyFd >= 0)
+    {
+      ev.data.fd = notifyFd;
+      epoll_ctl(epollFd, EPOLL_CTL_ADD, notifyFd, &ev);
+    }
+#endif
+  }
+
+  ~EventLoop()
+  {
+#ifdef __linux__
+    if (notifyFd >= 0)
+      close(notifyFd);
+    if (timerFd >= 0)
+      close(timerFd);
+    if (epollFd >= 0)
+      close(epollFd);
+#endif
+  }
+
+  EventLoop(const EventLoop &) = delete;
+  EventLoop &operator=(const EventLoop &) = delete;
+
+  // whether notify() can actually interrupt wait()
+  bool has_notify() const
+  {
+#ifdef __linux__
+    return epollFd >= 0 && timerFd >= 0 && notifyFd >= 0;
+#else
+    return false;
+#endif
+  }
+
+  // safe to call from any thread
+  void notify()
+  {
+#ifdef __linux__
+    if (notifyFd >= 0)
+    {
+      const uint64_t one = 1;
+      ssize_t res = write(notifyFd, &one, sizeof(one));
+      (void)res;
+    }
+#endif
+  }
+
+  // returns early as soon as there is something to receive or notify() was called
+  void wait(uint64_t timeout_nsec)
+  {
+    if (timeout_nsec == 0)
+      return;
+#ifdef __linux__
+    if (epollFd >= 0 && timerFd >= 0)
+    {
+      itimerspec spec = {};
+      spec.it_value.tv_sec = timeout_nsec / 1000000000;
+      spec.it_value.tv_nsec = timeout_nsec % 1000000000;
+      timerfd_settime(timerFd, 0, &spec, nullptr);
+      epoll_event events[3];
+      epoll_wait(epollFd, events, 3, -1); // EINTR just means an early wakeup
+      // clear the expiration and notifications, otherwise the next wait returns right away
+      uint64_t counter = 0;
+      ssize_t res = read(timerFd, &counter, sizeof(counter));
+      if (notifyFd >= 0)
+        res = read(notifyFd, &counter, sizeof(counter));
+      (void)res;
+      return;
+    }
+#endif
+    enet_uint32 condition = ENET_SOCKET_WAIT_RECEIVE;
+    enet_socket_wait(host->socket, &condition, enet_uint32((timeout_nsec + 999999) / 1000000));
+  }
+};
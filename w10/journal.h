@@ -0,0 +1,86 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <vector>
+
+// Binary journal of everything a server session was fed: joins, leaves and the
+// decoded client messages, each with the tick it was applied on. Together with
+// the world seed and the command line in the header that is enough to run the
+// session again, tick for tick.
+//
+// Layout, little endian, made to be mapped and used in place:
+//   JournalHeader (64 bytes)
+//   command line, `argsSize` bytes of NUL-separated arguments, padded to 8
+//   JournalRecord[] (24 bytes each) until the end of the file
+// A record cut short by a crash is ignored.
+
+constexpr uint32_t journalVersion = 1;
+
+enum JournalEventType : uint8_t
+{
+  E_JOURNAL_CONNECT = 0,
+  E_JOURNAL_DISCONNECT,
+  E_JOURNAL_JOIN,
+  E_JOURNAL_INPUT,
+  E_JOURNAL_SNAPSHOT_ACK,
+  E_JOURNAL_LOCKSTEP_RESYNC
+};
+
+struct JournalHeader
+{
+  char magic[4] = {'M', 'J', 'N', 'L'};
+  uint32_t version = journalVersion;
+  uint64_t seed = 0;
+  float tickRate = 0.f;
+  uint32_t peerCount = 0;
+  uint32_t argsSize = 0;
+  uint8_t reserved[36] = {};
+};
+static_assert(sizeof(JournalHeader) == 64);
+
+struct JournalRecord
+{
+  uint32_t tick;
+  uint16_t peer;
+  JournalEventType type;
+  uint8_t reserved;
+  uint16_t eid;
+  uint16_t seq;
+  float thr;
+  float steer;
+  uint32_t value; // incoming bandwidth on connect
+};
+static_assert(sizeof(JournalRecord) == 24);
+
+// Records are buffered by stdio, `flush` once per server loop so a spike can be
+// reproduced even if the process doesn't survive it.
+struct JournalWriter
+{
+  FILE *file = nullptr;
+  bool dirty = false;
+
+  ~JournalWriter();
+  // false if the file can't be created
+  bool open(const char *path, const JournalHeader &header, int argc, const char **argv);
+  void append(const JournalRecord &record);
+  void flush();
+};
+
+// Maps the journal where the platform can, reads it into memory otherwise.
+struct JournalReader
+{
+  JournalHeader header;
+  // the recorded command line with argv[0]
+  std::vector<const char *> args;
+  const JournalRecord *records = nullptr;
+  size_t count = 0;
+
+  const uint8_t *data = nullptr;
+  size_t size = 0;
+  std::vector<uint8_t> buffer;
+
+  ~JournalReader();
+  // false if the file is missing or not a journal of this version
+  bool open(const char *path);
+};
@@ -8,22 +8,30 @@
 #include <vector>
 #include "entity.h"
 #include "protocol.h"
+#include "entityRegistry.h"
 
 
 static std::vector<Entity> entities;
+static EntityRegistry registry; // eid -> index into `entities`
 static uint16_t my_entity = invalid_entity;
 
 void on_new_entity_packet(ENetPacket *packet)
 {
   Entity newEntity;
   deserialize_new_entity(packet, newEntity);
-  // TODO: Direct adressing, of course!
-  for (const Entity &e : entities)
-    if (e.eid == newEntity.eid)
-      return; // don't need to do anything, we already have entity
+  if (registry.insert(newEntity.eid) == invalid_handle)
+    return; // don't need to do anything, we already have entity
   entities.push_back(newEntity);
 }
 
+template<typename Callable>
+static void get_entity(uint16_t eid, Callable c)
+{
+  const uint32_t idx = registry.find_eid(eid);
+  if (idx != EntityRegistry::npos)
+    c(entities[idx]);
+}
+
 void on_set_controlled_entity(ENetPacket *packet)
 {
   deserialize_set_controlled_entity(packet, my_entity);
@@ -34,14 +42,25 @@ void on_snapshot(ENetPacket *packet)
   uint16_t eid = invalid_entity;
   float x = 0.f; float y = 0.f; float ori = 0.f;
   deserialize_snapshot(packet, eid, x, y, ori);
-  // TODO: Direct adressing, of course!
-  for (Entity &e : entities)
-    if (e.eid == eid)
+  get_entity(eid, [&](Entity &e)
+  {
+    e.x = x;
+    e.y = y;
+    e.ori = ori;
+  });
+}
+
+void on_world_snapshot(ENetPacket *packet)
+{
+  static std::vector<EntitySnapshot> snapshots;
+  deserialize_world_snapshot(packet, snapshots);
+  for (const EntitySnapshot &snap : snapshots)
+    get_entity(snap.eid, [&](Entity &e)
     {
-      e.x = x;
-      e.y = y;
-      e.ori = ori;
-    }
+      e.x = snap.x;
+      e.y = snap.y;
+      e.ori = snap.ori;
+    });
 }
 
 void on_key(ENetPacket *packet)
@@ -124,6 +143,9 @@ int main(int argc, const char **argv)
         case E_SERVER_TO_CLIENT_SNAPSHOT:
           on_snapshot(event.packet);
           break;
+        case E_SERVER_TO_CLIENT_WORLD_SNAPSHOT:
+          on_world_snapshot(event.packet);
+          break;
         case E_SERVER_TO_CLIENT_KEY:
           on_key(event.packet);
           break;
@@ -139,17 +161,15 @@ int main(int argc, const char **argv)
       bool right = IsKeyDown(KEY_RIGHT);
       bool up = IsKeyDown(KEY_UP);
       bool down = IsKeyDown(KEY_DOWN);
-      // TODO: Direct adressing, of course!
-      for (Entity &e : entities)
-        if (e.eid == my_entity)
-        {
-          // Update
-          float thr = (up ? 1.f : 0.f) + (down ? -1.f : 0.f);
-          float steer = (left ? -1.f : 0.f) + (right ? 1.f : 0.f);
+      get_entity(my_entity, [&](Entity &e)
+      {
+        // Update
+        float thr = (up ? 1.f : 0.f) + (down ? -1.f : 0.f);
+        float steer = (left ? -1.f : 0.f) + (right ? 1.f : 0.f);
 
-          // Send
-          send_entity_input(serverPeer, my_entity, thr, steer);
-        }
+        // Send
+        send_entity_input(serverPeer, my_entity, thr, steer);
+      });
     }
 
     BeginDrawing();
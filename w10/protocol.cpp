@@ -1,50 +1,75 @@
 #include "protocol.h"
 #include "quantisation.h"
-#include <cstring> // memcpy
+#include "bitStream.h"
+#include "messageSchema.h"
 #include <iostream>
 #include <stdlib.h>
+#include <algorithm>
 
 static uint32_t xorCipherKey = 0;
 
+struct WorldXRange { static constexpr float lo = -16.f; static constexpr float hi = 16.f; };
+struct WorldYRange { static constexpr float lo = -8.f; static constexpr float hi = 8.f; };
+struct AngleRange { static constexpr float lo = -PI; static constexpr float hi = PI; };
+
+struct JoinMsg {};
+struct EidMsg { uint16_t eid; };
+struct CipherKeyMsg { uint32_t key; };
+struct EntityInputMsg { uint16_t eid; float thr; float steer; };
+
+using JoinSchema = MessageSchema<E_CLIENT_TO_SERVER_JOIN, 0, ENET_PACKET_FLAG_RELIABLE, JoinMsg>;
+using NewEntitySchema = MessageSchema<E_SERVER_TO_CLIENT_NEW_ENTITY, 0, ENET_PACKET_FLAG_RELIABLE, Entity,
+  Field<&Entity::color, UIntCodec<32>>,
+  Field<&Entity::x, FloatCodec>,
+  Field<&Entity::y, FloatCodec>,
+  Field<&Entity::speed, FloatCodec>,
+  Field<&Entity::ori, FloatCodec>,
+  Field<&Entity::thr, FloatCodec>,
+  Field<&Entity::steer, FloatCodec>,
+  Field<&Entity::eid, UIntCodec<16>>>;
+using SetControlledEntitySchema = MessageSchema<E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY, 0, ENET_PACKET_FLAG_RELIABLE, EidMsg,
+  Field<&EidMsg::eid, UIntCodec<16>>>;
+using CipherKeySchema = MessageSchema<E_SERVER_TO_CLIENT_KEY, 0, ENET_PACKET_FLAG_RELIABLE, CipherKeyMsg,
+  Field<&CipherKeyMsg::key, UIntCodec<32>>>;
+using EntityInputSchema = MessageSchema<E_CLIENT_TO_SERVER_INPUT, 1, ENET_PACKET_FLAG_UNSEQUENCED, EntityInputMsg,
+  Field<&EntityInputMsg::eid, UIntCodec<16>>,
+  Field<&EntityInputMsg::thr, FloatCodec>,
+  Field<&EntityInputMsg::steer, FloatCodec>>;
+using EntitySnapshotRecord = RecordSchema<EntitySnapshot,
+  Field<&EntitySnapshot::eid, UIntCodec<16>>,
+  Field<&EntitySnapshot::x, QuantizedCodec<WorldXRange, PositionXQuantized::bits>>,
+  Field<&EntitySnapshot::y, QuantizedCodec<WorldYRange, PositionYQuantized::bits>>,
+  Field<&EntitySnapshot::ori, QuantizedCodec<AngleRange, OrientationQuantized::bits>>>;
+// the same record on its own
+using SnapshotSchema = RecordMessageSchema<E_SERVER_TO_CLIENT_SNAPSHOT, 1, ENET_PACKET_FLAG_UNSEQUENCED,
+                                           EntitySnapshotRecord>;
+
+static_assert(EntityInputSchema::size == 11);
+static_assert(SnapshotSchema::size == 7);
+
 void send_join(ENetPeer *peer)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t), ENET_PACKET_FLAG_RELIABLE);
-  *packet->data = E_CLIENT_TO_SERVER_JOIN;
-
-  enet_peer_send(peer, 0, packet);
+  JoinSchema::send(peer, {});
 }
 
 void send_new_entity(ENetPeer *peer, const Entity &ent)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(Entity),
-                                                   ENET_PACKET_FLAG_RELIABLE);
-  uint8_t *ptr = packet->data;
-  *ptr = E_SERVER_TO_CLIENT_NEW_ENTITY; ptr += sizeof(uint8_t);
-  memcpy(ptr, &ent, sizeof(Entity)); ptr += sizeof(Entity);
+  NewEntitySchema::send(peer, ent);
+}
 
-  enet_peer_send(peer, 0, packet);
+void broadcast_new_entity(ENetHost *host, const Entity &ent)
+{
+  NewEntitySchema::broadcast(host, ent);
 }
 
 void send_set_controlled_entity(ENetPeer *peer, uint16_t eid)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t),
-                                                   ENET_PACKET_FLAG_RELIABLE);
-  uint8_t *ptr = packet->data;
-  *ptr = E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY; ptr += sizeof(uint8_t);
-  memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
-
-  enet_peer_send(peer, 0, packet);
+  SetControlledEntitySchema::send(peer, {eid});
 }
 
 void send_cipher_key(ENetPeer *peer, uint32_t key)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint32_t),
-                                                   ENET_PACKET_FLAG_RELIABLE);
-  uint8_t *ptr = packet->data;
-  *ptr = E_SERVER_TO_CLIENT_KEY; ptr += sizeof(uint8_t);
-  memcpy(ptr, &key, sizeof(uint32_t)); ptr += sizeof(uint32_t);
-
-  enet_peer_send(peer, 0, packet);
+  CipherKeySchema::send(peer, {key});
 }
 
 void fuzz_packet_data(ENetPacket *packet)
@@ -54,51 +79,48 @@ void fuzz_packet_data(ENetPacket *packet)
 
 void send_entity_input(ENetPeer *peer, uint16_t eid, float thr, float ori)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t) +
-                                                   sizeof(float) * 2,
-                                                   //sizeof(uint8_t),
-                                                   ENET_PACKET_FLAG_UNSEQUENCED);
-  uint8_t *ptr = packet->data;
-  *ptr = E_CLIENT_TO_SERVER_INPUT; ptr += sizeof(uint8_t);
-  memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
-  memcpy(ptr, &thr, sizeof(float)); ptr += sizeof(float);
-  memcpy(ptr, &ori, sizeof(float)); ptr += sizeof(float);
-  /*
-  float4bitsQuantized thrPacked(thr, -1.f, 1.f);
-  float4bitsQuantized oriPacked(ori, -1.f, 1.f);
-  uint8_t thrSteerPacked = (thrPacked.packedVal << 4) | oriPacked.packedVal;
-  memcpy(ptr, &thrSteerPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
-  */
-  /*
-  memcpy(ptr, &thrPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
-  memcpy(ptr, &oriPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
-  */
+  ENetPacket *packet = EntityInputSchema::create_packet({eid, thr, ori});
 
   fuzz_packet_data(packet);
   cipher_data(packet);
 
-  enet_peer_send(peer, 1, packet);
+  send_packet(peer, 1, packet);
 }
 
 void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float ori)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t) +
-                                                   sizeof(uint16_t) +
-                                                   sizeof(uint16_t) +
-                                                   sizeof(uint8_t),
-                                                   ENET_PACKET_FLAG_UNSEQUENCED);
-  uint8_t *ptr = packet->data;
-  *ptr = E_SERVER_TO_CLIENT_SNAPSHOT; ptr += sizeof(uint8_t);
-  memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
-  uint16_t xPacked = pack_float<uint16_t>(x, -16.f, 16.f, 11);
-  uint16_t yPacked = pack_float<uint16_t>(y, -8.f, 8.f, 10);
-  uint8_t oriPacked = pack_float<uint8_t>(ori, -PI, PI, 8);
-  //printf("xPacked/unpacked %d %f\n", xPacked, x);
-  memcpy(ptr, &xPacked, sizeof(uint16_t)); ptr += sizeof(uint16_t);
-  memcpy(ptr, &yPacked, sizeof(uint16_t)); ptr += sizeof(uint16_t);
-  memcpy(ptr, &oriPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
-
-  enet_peer_send(peer, 1, packet);
+  SnapshotSchema::send(peer, {eid, x, y, ori});
+}
+
+// keep world snapshots below ENet's default MTU so they are never fragmented
+constexpr size_t maxSnapshotPacketSize = 1200;
+
+template<typename Callable>
+static void create_world_snapshot_packets(const std::vector<EntitySnapshot> &snapshots, Callable c)
+{
+  static uint8_t buffer[maxSnapshotPacketSize];
+  constexpr size_t maxEntitiesPerSnapshot = ((maxSnapshotPacketSize - sizeof(uint8_t)) * 8 - 16) /
+                                            EntitySnapshotRecord::bits;
+  for (size_t first = 0; first < snapshots.size(); first += maxEntitiesPerSnapshot)
+  {
+    uint16_t count = std::min(snapshots.size() - first, maxEntitiesPerSnapshot);
+    BitWriter writer(buffer, sizeof(buffer));
+    writer.write_bits(E_SERVER_TO_CLIENT_WORLD_SNAPSHOT, 8);
+    writer.write_bits(count, 16);
+    for (size_t i = first; i < first + count; ++i)
+      EntitySnapshotRecord::write(writer, snapshots[i]);
+    c(enet_packet_create(buffer, writer.flush(), ENET_PACKET_FLAG_UNSEQUENCED));
+  }
+}
+
+void send_world_snapshot(ENetPeer *peer, const std::vector<EntitySnapshot> &snapshots)
+{
+  create_world_snapshot_packets(snapshots, [&](ENetPacket *packet) { send_packet(peer, 1, packet); });
+}
+
+void broadcast_world_snapshot(ENetHost *host, const std::vector<EntitySnapshot> &snapshots)
+{
+  create_world_snapshot_packets(snapshots, [&](ENetPacket *packet) { enet_host_broadcast(host, 1, packet); });
 }
 
 MessageType get_packet_type(ENetPacket *packet)
@@ -108,14 +130,14 @@ MessageType get_packet_type(ENetPacket *packet)
 
 void deserialize_new_entity(ENetPacket *packet, Entity &ent)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  ent = *(Entity*)(ptr); ptr += sizeof(Entity);
+  NewEntitySchema::deserialize(packet, ent);
 }
 
 void deserialize_set_controlled_entity(ENetPacket *packet, uint16_t &eid)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+  EidMsg msg = {invalid_entity};
+  SetControlledEntitySchema::deserialize(packet, msg);
+  eid = msg.eid;
 }
 
 void xor_packet_data(ENetPacket *packet, uint8_t *key_ptr)
@@ -141,40 +163,39 @@ void decipher_data(ENetPacket *packet, ENetPeer *peer)
 
 void deserialize_entity_input(ENetPacket *packet, uint16_t &eid, float &thr, float &steer)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-
-  eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  thr = *(float*)(ptr); ptr += sizeof(float);
-  steer = *(float*)(ptr); ptr += sizeof(float);
-  //uint8_t thrSteerPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  /*
-  uint8_t thrPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  uint8_t oriPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  */
-  /*
-  static uint8_t neutralPackedValue = pack_float<uint8_t>(0.f, -1.f, 1.f, 4);
-  float4bitsQuantized thrPacked(thrSteerPacked >> 4);
-  float4bitsQuantized steerPacked(thrSteerPacked & 0x0f);
-  thr = thrPacked.packedVal == neutralPackedValue ? 0.f : thrPacked.unpack(-1.f, 1.f);
-  steer = steerPacked.packedVal == neutralPackedValue ? 0.f : steerPacked.unpack(-1.f, 1.f);
-  */
+  EntityInputMsg msg;
+  if (!EntityInputSchema::deserialize(packet, msg))
+    msg.eid = invalid_entity;
+  eid = msg.eid;
+  thr = msg.thr;
+  steer = msg.steer;
 }
 
 void deserialize_snapshot(ENetPacket *packet, uint16_t &eid, float &x, float &y, float &ori)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  uint16_t xPacked = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  uint16_t yPacked = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  uint8_t oriPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  x = unpack_float<uint16_t>(xPacked, -16.f, 16.f, 11);
-  y = unpack_float<uint16_t>(yPacked, -8.f, 8.f, 10);
-  ori = unpack_float<uint8_t>(oriPacked, -PI, PI, 8);
+  EntitySnapshot msg;
+  if (!SnapshotSchema::deserialize(packet, msg))
+    msg.eid = invalid_entity;
+  eid = msg.eid;
+  x = msg.x;
+  y = msg.y;
+  ori = msg.ori;
 }
 
-void deserialize_and_set_key(ENetPacket *packet)
+void deserialize_world_snapshot(ENetPacket *packet, std::vector<EntitySnapshot> &snapshots)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  xorCipherKey = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
+  BitReader reader(packet->data, packet->dataLength);
+  reader.read_bits(8);
+  uint16_t count = reader.read_bits(16);
+  // never trust the count more than the actual packet size
+  snapshots.resize(std::min<size_t>(count, reader.get_bits_remaining() / EntitySnapshotRecord::bits));
+  for (EntitySnapshot &snap : snapshots)
+    EntitySnapshotRecord::read(reader, snap);
 }
 
+void deserialize_and_set_key(ENetPacket *packet)
+{
+  CipherKeyMsg msg = {xorCipherKey};
+  CipherKeySchema::deserialize(packet, msg);
+  xorCipherKey = msg.key;
+}
@@ -1,8 +1,17 @@
 #pragma once
 #include <enet/enet.h>
 #include <cstdint>
+#include <vector>
 #include "entity.h"
 
+struct EntitySnapshot
+{
+  uint16_t eid = invalid_entity;
+  float x = 0.f;
+  float y = 0.f;
+  float ori = 0.f;
+};
+
 enum MessageType : uint8_t
 {
   E_CLIENT_TO_SERVER_JOIN = 0,
@@ -10,15 +19,21 @@ enum MessageType : uint8_t
   E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY,
   E_CLIENT_TO_SERVER_INPUT,
   E_SERVER_TO_CLIENT_SNAPSHOT,
-  E_SERVER_TO_CLIENT_KEY
+  E_SERVER_TO_CLIENT_KEY,
+  E_SERVER_TO_CLIENT_WORLD_SNAPSHOT
 };
 
 void send_join(ENetPeer *peer);
 void send_new_entity(ENetPeer *peer, const Entity &ent);
+// encode once and share a single packet between all connected peers
+void broadcast_new_entity(ENetHost *host, const Entity &ent);
 void send_set_controlled_entity(ENetPeer *peer, uint16_t eid);
 void send_cipher_key(ENetPeer *peer, uint32_t key);
 void send_entity_input(ENetPeer *peer, uint16_t eid, float thr, float steer);
 void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float ori);
+// packs all entity updates into as few MTU-sized packets as possible
+void send_world_snapshot(ENetPeer *peer, const std::vector<EntitySnapshot> &snapshots);
+void broadcast_world_snapshot(ENetHost *host, const std::vector<EntitySnapshot> &snapshots);
 
 MessageType get_packet_type(ENetPacket *packet);
 
@@ -26,8 +41,11 @@ void deserialize_new_entity(ENetPacket *packet, Entity &ent);
 void deserialize_set_controlled_entity(ENetPacket *packet, uint16_t &eid);
 void deserialize_entity_input(ENetPacket *packet, uint16_t &eid, float &thr, float &steer);
 void deserialize_snapshot(ENetPacket *packet, uint16_t &eid, float &x, float &y, float &ori);
+void deserialize_world_snapshot(ENetPacket *packet, std::vector<EntitySnapshot> &snapshots);
 void deserialize_and_set_key(ENetPacket *packet);
 
+// xors everything after the message type with the 4-byte key, its own inverse
+void xor_packet_data(ENetPacket *packet, uint8_t *key_ptr);
 void cipher_data(ENetPacket *packet);
 void decipher_data(ENetPacket *packet, ENetPeer *peer);
 
@@ -0,0 +1,72 @@
+#pragma once
+#include <cstdint>
+
+// Small deterministic random numbers. Everything is derived from a world seed,
+// so a session started with the same seed makes the same decisions.
+//  - rng_at(seed, stream, counter) is counter based: a pure function, good for
+//    anything that can name its draw, like an entity's AI at a given tick. No
+//    state means no sharing, any thread can evaluate any entity.
+//  - Rng is xoshiro128** for sequences that are drawn one after another, one
+//    instance per stream (per thread, per subsystem), never shared.
+
+// splitmix64 finaliser, every bit of the input affects every bit of the output
+inline uint64_t mix64(uint64_t z)
+{
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+inline uint64_t rng_at(uint64_t seed, uint32_t stream, uint32_t counter)
+{
+  return mix64(mix64(seed + 0x9e3779b97f4a7c15ull * (uint64_t(stream) + 1)) ^ counter);
+}
+
+// [0, bound) without a division, the bias is at most bound / 2^32
+inline uint32_t rng_below(uint32_t r, uint32_t bound)
+{
+  return uint32_t((uint64_t(r) * bound) >> 32);
+}
+
+// [0, 1) from the top 24 bits
+inline float rng_float(uint32_t r)
+{
+  return float(r >> 8) * (1.f / 16777216.f);
+}
+
+inline uint32_t rotl(uint32_t x, int k)
+{
+  return (x << k) | (x >> (32 - k));
+}
+
+struct Rng
+{
+  uint32_t s[4];
+
+  explicit Rng(uint64_t seed, uint32_t stream = 0)
+  {
+    const uint64_t a = rng_at(seed, stream, 0);
+    const uint64_t b = rng_at(seed, stream, 1);
+    s[0] = uint32_t(a);
+    s[1] = uint32_t(a >> 32);
+    s[2] = uint32_t(b);
+    s[3] = uint32_t(b >> 32) | 1; // never all zeroes
+  }
+
+  uint32_t next()
+  {
+    const uint32_t result = rotl(s[1] * 5, 7) * 9;
+    const uint32_t t = s[1] << 9;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 11);
+    return result;
+  }
+
+  uint32_t below(uint32_t bound) { return rng_below(next(), bound); }
+  float uniform() { return rng_float(next()); }
+  float uniform(float lo, float hi) { return lo + (hi - lo) * uniform(); }
+};
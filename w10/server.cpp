@@ -2,66 +2,193 @@
 #include <iostream>
 #include "entity.h"
 #include "protocol.h"
+#include "messageSchema.h"
 #include "mathUtils.h"
+#include "entityHistory.h"
+#include "fixedTimestep.h"
+#include "eventLoop.h"
+#include "entityRegistry.h"
+#include "rng.h"
+#include "journal.h"
 #include <stdlib.h>
+#include <string.h>
 #include <vector>
-#include <map>
+#include <algorithm>
 #include <random>
 
 static std::vector<Entity> entities;
-static std::map<uint16_t, ENetPeer*> controlledMap;
+static EntityRegistry registry; // eid -> index into `entities`
+// ships live until the server stops, so eids are never reused
+static uint16_t nextEid = 0;
+// spawns derive from the world seed, --seed replays them
+static Rng spawnRng(0);
+// cipher keys must not be predictable from a seed that shows up in logs
+static Rng keyRng(0);
 
-void on_join(ENetPacket *packet, ENetPeer *peer, ENetHost *host)
+// lag compensation, a second of the world at the default tick rate
+constexpr size_t lagCompensationTicks = 64;
+constexpr size_t maxRecordedEntities = 256;
+static EntityHistory entityHistory(lagCompensationTicks, maxRecordedEntities, 0.f);
+
+void on_join(ENetPeer *peer, ENetHost *host)
 {
   // send all entities
   for (const Entity &ent : entities)
     send_new_entity(peer, ent);
 
-  // find max eid
-  uint16_t maxEid = entities.empty() ? invalid_entity : entities[0].eid;
-  for (const Entity &e : entities)
-    maxEid = std::max(maxEid, e.eid);
-  uint16_t newEid = maxEid + 1;
+  if (nextEid == invalid_entity)
+    return; // the world is full
+  uint16_t newEid = nextEid++;
   uint32_t color = 0xff000000 +
-                   0x00440000 * (rand() % 5) +
-                   0x00004400 * (rand() % 5) +
-                   0x00000044 * (rand() % 5);
-  float x = (rand() % 4) * 2.f;
-  float y = (rand() % 4) * 2.f;
-  Entity ent = {color, x, y, 0.f, (rand() / RAND_MAX) * 3.141592654f, 0.f, 0.f, newEid};
+                   0x00440000 * spawnRng.below(5) +
+                   0x00004400 * spawnRng.below(5) +
+                   0x00000044 * spawnRng.below(5);
+  float x = spawnRng.below(4) * 2.f;
+  float y = spawnRng.below(4) * 2.f;
+  Entity ent = {color, x, y, 0.f, spawnRng.uniform() * PI, 0.f, 0.f, newEid};
+  registry.insert(newEid);
   entities.push_back(ent);
 
-  controlledMap[newEid] = peer;
-
-
-  // send info about new entity to everyone
-  for (size_t i = 0; i < host->peerCount; ++i)
-    send_new_entity(&host->peers[i], ent);
+  // send info about new entity to everyone, encoded once
+  broadcast_new_entity(host, ent);
   // send info about controlled entity
   send_set_controlled_entity(peer, newEid);
   uint32_t *keyPtr = (uint32_t*)peer->data;
-  std::random_device rd;  //Will be used to obtain a seed for the random number engine
-  std::mt19937 gen(rd()); //Standard mersenne_twister_engine seeded with rd()
-  std::uniform_int_distribution<uint32_t> distrib(0);
-  *keyPtr = distrib(gen);
+  *keyPtr = keyRng.next();
   send_cipher_key(peer, *keyPtr);
 }
 
-void on_input(ENetPacket *packet)
+static void apply_input(uint16_t eid, float thr, float steer)
+{
+  const uint32_t idx = registry.find_eid(eid);
+  if (idx == EntityRegistry::npos)
+    return;
+  entities[idx].thr = thr;
+  entities[idx].steer = steer;
+}
+
+// --journal: connects, joins, inputs and leaves with the tick they landed before,
+// w10_replay runs them again
+static JournalWriter journal;
+
+static void record_event(uint32_t tick, ENetPeer *peer, JournalEventType type, uint16_t eid = invalid_entity,
+                         float thr = 0.f, float steer = 0.f)
+{
+  JournalRecord record = {};
+  record.tick = tick;
+  record.peer = uint16_t(peer - peer->host->peers);
+  record.type = type;
+  record.eid = eid;
+  record.thr = thr;
+  record.steer = steer;
+  record.value = type == E_JOURNAL_CONNECT ? peer->incomingBandwidth : 0;
+  journal.append(record);
+}
+
+void on_input(ENetPacket *packet, ENetPeer *peer, uint32_t tick)
 {
   uint16_t eid = invalid_entity;
   float thr = 0.f; float steer = 0.f;
   deserialize_entity_input(packet, eid, thr, steer);
+  record_event(tick, peer, E_JOURNAL_INPUT, eid, thr, steer);
+  apply_input(eid, thr, steer);
+}
+
+static void on_connect(ENetPeer *peer)
+{
+  peer->data = new uint32_t(0);
+}
+
+static void on_disconnect(ENetPeer *peer)
+{
+  delete (uint32_t*)peer->data;
+  peer->data = nullptr;
+}
+
+static void run_tick(ENetHost *host, const FixedTimestep &timestep, uint32_t snapshot_interval)
+{
+  // simulate
   for (Entity &e : entities)
-    if (e.eid == eid)
-    {
-      e.thr = thr;
-      e.steer = steer;
-    }
+    simulate_entity(e, timestep.dt());
+  entityHistory.record(timestep.tick, entities);
+
+  if (timestep.tick % snapshot_interval == 0)
+  {
+    static std::vector<EntitySnapshot> worldSnapshot;
+    worldSnapshot.clear();
+    for (const Entity &e : entities)
+      worldSnapshot.push_back({e.eid, e.x, e.y, e.ori});
+    // send, everyone sees the same world so the batched snapshot is encoded once
+    broadcast_world_snapshot(host, worldSnapshot);
+  }
 }
 
-int main(int argc, const char **argv)
+static float get_arg(int argc, const char **argv, const char *name, float default_val)
+{
+  for (int i = 1; i + 1 < argc; ++i)
+    if (strcmp(argv[i], name) == 0)
+      return atof(argv[i + 1]);
+  return default_val;
+}
+
+static bool has_flag(int argc, const char **argv, const char *name)
+{
+  for (int i = 1; i < argc; ++i)
+    if (strcmp(argv[i], name) == 0)
+      return true;
+  return false;
+}
+
+static uint64_t random_seed()
+{
+  std::random_device rd;
+  return uint64_t(rd()) << 32 | rd();
+}
+
+// 64-bit values don't survive the float of get_arg
+static const char *get_string_arg(int argc, const char **argv, const char *name)
+{
+  for (int i = 1; i + 1 < argc; ++i)
+    if (strcmp(argv[i], name) == 0)
+      return argv[i + 1];
+  return nullptr;
+}
+
+static uint64_t get_seed(int argc, const char **argv)
+{
+  for (int i = 1; i + 1 < argc; ++i)
+    if (strcmp(argv[i], "--seed") == 0)
+      return strtoull(argv[i + 1], nullptr, 0);
+  return random_seed();
+}
+
+struct ServerOptions
 {
+  float tickRate;
+  // snapshots go out every n-th tick
+  uint32_t snapshotInterval;
+};
+
+// everything that changes what the simulation does comes from here, the replay
+// runs the recorded command line through it again
+static ServerOptions configure(int argc, const char **argv)
+{
+  ServerOptions options;
+  options.tickRate = get_arg(argc, argv, "--tick-rate", 60.f);
+  const float snapshotRate = get_arg(argc, argv, "--snapshot-rate", 30.f);
+  options.snapshotInterval = std::max(1, int(roundf(options.tickRate / snapshotRate)));
+  return options;
+}
+
+int server_main(int argc, const char **argv)
+{
+  const ServerOptions options = configure(argc, argv);
+
+  const uint64_t worldSeed = get_seed(argc, argv);
+  spawnRng = Rng(worldSeed);
+  keyRng = Rng(random_seed());
+  printf("World seed %llu\n", (unsigned long long)worldSeed);
+
   if (enet_initialize() != 0)
   {
     printf("Cannot init ENet");
@@ -80,12 +207,20 @@ int main(int argc, const char **argv)
     return 1;
   }
 
-  uint32_t lastTime = enet_time_get();
+  if (const char *journalPath = get_string_arg(argc, argv, "--journal"))
+  {
+    JournalHeader header;
+    header.seed = worldSeed;
+    header.tickRate = options.tickRate;
+    header.peerCount = uint32_t(server->peerCount);
+    if (!journal.open(journalPath, header, argc, argv))
+      printf("Cannot create journal %s\n", journalPath);
+  }
+
+  FixedTimestep timestep(options.tickRate);
+  EventLoop eventLoop(server);
   while (true)
   {
-    uint32_t curTime = enet_time_get();
-    float dt = (curTime - lastTime) * 0.001f;
-    lastTime = curTime;
     ENetEvent event;
     while (enet_host_service(server, &event, 0) > 0)
     {
@@ -93,22 +228,26 @@ int main(int argc, const char **argv)
       {
       case ENET_EVENT_TYPE_CONNECT:
         printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
-        event.peer->data = new uint32_t;
-        *(uint32_t*)event.peer->data = 0;
+        on_connect(event.peer);
+        record_event(timestep.tick, event.peer, E_JOURNAL_CONNECT);
         break;
       case ENET_EVENT_TYPE_DISCONNECT:
         printf("Disconnected %x:%u \n", event.peer->address.host, event.peer->address.port);
-        delete event.peer->data;
+        on_disconnect(event.peer);
+        record_event(timestep.tick, event.peer, E_JOURNAL_DISCONNECT);
         break;
       case ENET_EVENT_TYPE_RECEIVE:
         switch (get_packet_type(event.packet))
         {
           case E_CLIENT_TO_SERVER_JOIN:
-            on_join(event.packet, event.peer, server);
+            record_event(timestep.tick, event.peer, E_JOURNAL_JOIN);
+            on_join(event.peer, server);
             break;
           case E_CLIENT_TO_SERVER_INPUT:
             decipher_data(event.packet, event.peer);
-            on_input(event.packet);
+            on_input(event.packet, event.peer, timestep.tick);
+            break;
+          default:
             break;
         };
         enet_packet_destroy(event.packet);
@@ -117,21 +256,15 @@ int main(int argc, const char **argv)
         break;
       };
     }
-    static int t = 0;
-    for (Entity &e : entities)
+    for (uint32_t due = timestep.advance(); due > 0; --due)
     {
-      // simulate
-      simulate_entity(e, dt);
-      // send
-      for (size_t i = 0; i < server->peerCount; ++i)
-      {
-        ENetPeer *peer = &server->peers[i];
-        // skip this here in this implementation
-        //if (controlledMap[e.eid] != peer)
-        send_snapshot(peer, e.eid, e.x, e.y, e.ori);
-      }
+      const uint64_t tickStart = get_time_nsec();
+      run_tick(server, timestep, options.snapshotInterval);
+      timestep.end_tick(get_time_nsec() - tickStart);
     }
-    usleep(10000);
+    journal.flush();
+    enet_host_flush(server);
+    eventLoop.wait(timestep.time_to_next_tick());
   }
 
   enet_host_destroy(server);
@@ -140,4 +273,112 @@ int main(int argc, const char **argv)
   return 0;
 }
 
+static void apply_journal_record(const JournalRecord &record, ENetHost *host)
+{
+  ENetPeer *peer = &host->peers[record.peer];
+  switch (record.type)
+  {
+  case E_JOURNAL_CONNECT:
+    on_connect(peer);
+    break;
+  case E_JOURNAL_DISCONNECT:
+    on_disconnect(peer);
+    break;
+  case E_JOURNAL_JOIN:
+    on_join(peer, host);
+    break;
+  case E_JOURNAL_INPUT:
+    apply_input(record.eid, record.thr, record.steer);
+    break;
+  default:
+    break; // w7 only
+  };
+}
+
+static void discard_packet(void *user, ENetPeer *, uint8_t, ENetPacket *packet, bool last)
+{
+  *(size_t*)user += packet->dataLength;
+  if (last && packet->referenceCount == 0)
+    enet_packet_destroy(packet);
+}
+
+// Runs a journal through the simulation as fast as it goes, with the recorded
+// command line and seed, and times every tick. A zeroed host stands in for the
+// real one: its peers are never connected, so broadcasts are encoded and dropped
+// by ENet and only the per-peer messages show up in the byte count.
+// usage: w10_replay <journal> [--per-tick]
+int replay_main(int argc, const char **argv)
+{
+  JournalReader reader;
+  if (argc < 2 || !reader.open(argv[1]))
+  {
+    printf("usage: w10_replay <journal> [--per-tick]\n");
+    return 1;
+  }
+  const ServerOptions options = configure(int(reader.args.size()), reader.args.data());
+  const bool perTick = has_flag(argc, argv, "--per-tick");
+
+  if (enet_initialize() != 0)
+  {
+    printf("Cannot init ENet");
+    return 1;
+  }
+  std::vector<ENetPeer> peers(reader.header.peerCount);
+  ENetHost host = {};
+  host.peers = peers.data();
+  host.peerCount = peers.size();
+  for (ENetPeer &peer : peers)
+    peer.host = &host;
+  spawnRng = Rng(reader.header.seed);
+
+  size_t bytesSent = 0;
+  packetSink = {discard_packet, &bytesSent};
+  FixedTimestep timestep(options.tickRate);
+  const uint32_t lastTick = reader.count > 0 ? reader.records[reader.count - 1].tick : 0;
+  std::vector<uint64_t> tickNsec;
+  tickNsec.reserve(lastTick + 1);
+  size_t next = 0;
+  if (perTick)
+    printf("tick usec bytes\n");
+  const uint64_t replayStart = get_time_nsec();
+  for (uint32_t tick = 0; tick <= lastTick; ++tick)
+  {
+    timestep.tick = tick;
+    const size_t bytesBefore = bytesSent;
+    const uint64_t tickStart = get_time_nsec();
+    for (; next < reader.count && reader.records[next].tick <= tick; ++next)
+    {
+      if (reader.records[next].peer >= peers.size())
+        continue; // not a journal of this server
+      apply_journal_record(reader.records[next], &host);
+    }
+    run_tick(&host, timestep, options.snapshotInterval);
+    tickNsec.push_back(get_time_nsec() - tickStart);
+    if (perTick)
+      printf("%u %.1f %zu\n", tick, tickNsec.back() * 1e-3, bytesSent - bytesBefore);
+  }
+  const double totalMsec = (get_time_nsec() - replayStart) * 1e-6;
+  for (ENetPeer &peer : peers)
+    delete (uint32_t*)peer.data;
+
+  std::vector<uint64_t> sorted = tickNsec;
+  std::sort(sorted.begin(), sorted.end());
+  const size_t worst = std::max_element(tickNsec.begin(), tickNsec.end()) - tickNsec.begin();
+  auto percentile = [&](double p) { return sorted[std::min(sorted.size() - 1, size_t(p * sorted.size()))] * 1e-3; };
+  printf("%zu events, %zu ticks in %.1f ms (%.1fx real time), %zu entities, %zu bytes sent\n",
+         reader.count, tickNsec.size(), totalMsec, tickNsec.size() / options.tickRate * 1e3 / totalMsec,
+         entities.size(), bytesSent);
+  printf("tick usec: p50 %.1f p90 %.1f p99 %.1f max %.1f (tick %zu)\n",
+         percentile(0.5), percentile(0.9), percentile(0.99), sorted.back() * 1e-3, worst);
+  enet_deinitialize();
+  return 0;
+}
 
+int main(int argc, const char **argv)
+{
+#ifdef W10_REPLAY
+  return replay_main(argc, argv);
+#else
+  return server_main(argc, argv);
+#endif
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <utility>
+
+// 32-bit entity handle: the low 16 bits are the eid that goes over the wire, the
+// high 16 bits are the generation of that eid. Removing an entity bumps the
+// generation, so handles kept around after that stop resolving instead of
+// silently pointing at whatever gets the eid next.
+using EntityHandle = uint32_t;
+constexpr EntityHandle invalid_handle = ~0u;
+
+inline EntityHandle make_handle(uint16_t eid, uint16_t generation)
+{
+  return (uint32_t(generation) << 16) | eid;
+}
+inline uint16_t handle_eid(EntityHandle h) { return uint16_t(h & 0xffff); }
+inline uint16_t handle_generation(EntityHandle h) { return uint16_t(h >> 16); }
+
+// Sparse set from eids to positions in a dense entity array: O(1) lookup, O(1)
+// removal by moving the last entity into the hole, and the dense array stays
+// packed for simulation. The registry only keeps the indices, the owner keeps
+// its entity array in the same order and mirrors every insert and erase.
+struct EntityRegistry
+{
+  static constexpr uint32_t npos = ~0u;
+
+  std::vector<uint32_t> sparse;      // by eid, dense position or npos
+  std::vector<uint16_t> generations; // by eid, generation of the live (or next) handle
+  std::vector<EntityHandle> dense;   // handles in dense order
+
+  size_t size() const { return dense.size(); }
+
+  // the entity goes to the back of the dense array, invalid_handle if the eid is taken
+  EntityHandle insert(uint16_t eid)
+  {
+    if (eid >= sparse.size())
+    {
+      sparse.resize(size_t(eid) + 1, npos);
+      generations.resize(size_t(eid) + 1, 0);
+    }
+    if (sparse[eid] != npos || eid == handle_eid(invalid_handle))
+      return invalid_handle;
+    const EntityHandle h = make_handle(eid, generations[eid]);
+    sparse[eid] = uint32_t(dense.size());
+    dense.push_back(h);
+    return h;
+  }
+
+  // dense position, npos if the handle is stale
+  uint32_t find(EntityHandle h) const
+  {
+    const uint32_t pos = find_eid(handle_eid(h));
+    return pos != npos && dense[pos] == h ? pos : npos;
+  }
+
+  // dense position of whatever lives under the eid right now, npos if nothing does
+  uint32_t find_eid(uint16_t eid) const
+  {
+    return eid < sparse.size() ? sparse[eid] : npos;
+  }
+
+  EntityHandle handle_at(uint32_t pos) const { return dense[pos]; }
+
+  // returns the position that was freed, the owner moves its last entity there and pops
+  // the back, npos if the handle is stale
+  uint32_t erase(EntityHandle h)
+  {
+    const uint32_t pos = find(h);
+    if (pos == npos)
+      return npos;
+    const uint16_t eid = handle_eid(h);
+    const EntityHandle last = dense.back();
+    dense[pos] = last;
+    sparse[handle_eid(last)] = pos;
+    dense.pop_back();
+    sparse[eid] = npos;
+    ++generations[eid];
+    return pos;
+  }
+};
+
+// mirrors EntityRegistry::erase on an array kept in dense order
+template<typename Container>
+inline void swap_remove(Container &items, uint32_t pos)
+{
+  if (pos + 1 != items.size())
+    items[pos] = std::move(items.back());
+  items.pop_back();
+}
@@ -6,20 +6,19 @@
 #include <vector>
 #include "entity.h"
 #include "protocol.h"
+#include "entityRegistry.h"
 
 
 static std::vector<Entity> entities;
-static std::unordered_map<uint16_t, size_t> indexMap;
+static EntityRegistry registry; // eid -> index into `entities`
 static uint16_t my_entity = invalid_entity;
 
 void on_new_entity_packet(ENetPacket *packet)
 {
   Entity newEntity;
   deserialize_new_entity(packet, newEntity);
-  auto itf = indexMap.find(newEntity.eid);
-  if (itf != indexMap.end())
+  if (registry.insert(newEntity.eid) == invalid_handle)
     return; // don't need to do anything, we already have entity
-  indexMap[newEntity.eid] = entities.size();
   entities.push_back(newEntity);
 }
 
@@ -31,9 +30,9 @@ void on_set_controlled_entity(ENetPacket *packet)
 template<typename Callable>
 static void get_entity(uint16_t eid, Callable c)
 {
-  auto itf = indexMap.find(eid);
-  if (itf != indexMap.end())
-    c(entities[itf->second]);
+  const uint32_t idx = registry.find_eid(eid);
+  if (idx != EntityRegistry::npos)
+    c(entities[idx]);
 }
 
 void on_snapshot(ENetPacket *packet)
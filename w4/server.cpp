@@ -2,12 +2,16 @@
 #include <iostream>
 #include "entity.h"
 #include "protocol.h"
+#include "fixedTimestep.h"
+#include "eventLoop.h"
+#include "entityRegistry.h"
 #include <stdlib.h>
 #include <vector>
-#include <map>
 
 static std::vector<Entity> entities;
-static std::map<uint16_t, ENetPeer*> controlledMap;
+static EntityRegistry registry; // eid -> index into `entities`
+// the ship each peer steers, indexed by peer - host->peers
+static std::vector<EntityHandle> controlledByPeer;
 
 static uint16_t create_random_entity()
 {
@@ -19,6 +23,7 @@ static uint16_t create_random_entity()
   float x = (rand() % 40 - 20) * 5.f;
   float y = (rand() % 40 - 20) * 5.f;
   Entity ent = {color, x, y, newEid, false, 0.f, 0.f};
+  registry.insert(newEid);
   entities.push_back(ent);
   return newEid;
 }
@@ -33,7 +38,7 @@ void on_join(ENetPacket *packet, ENetPeer *peer, ENetHost *host)
   uint16_t newEid = create_random_entity();
   const Entity& ent = entities[newEid];
 
-  controlledMap[newEid] = peer;
+  controlledByPeer[peer - host->peers] = registry.handle_at(registry.find_eid(newEid));
 
 
   // send info about new entity to everyone
@@ -48,12 +53,42 @@ void on_state(ENetPacket *packet)
   uint16_t eid = invalid_entity;
   float x = 0.f; float y = 0.f;
   deserialize_entity_state(packet, eid, x, y);
+  const uint32_t idx = registry.find_eid(eid);
+  if (idx == EntityRegistry::npos)
+    return;
+  entities[idx].x = x;
+  entities[idx].y = y;
+}
+
+static void simulate_world(ENetHost *server, float dt)
+{
   for (Entity &e : entities)
-    if (e.eid == eid)
+  {
+    if (e.serverControlled)
+    {
+      const float diffX = e.targetX - e.x;
+      const float diffY = e.targetY - e.y;
+      const float dirX = diffX > 0.f ? 1.f : -1.f;
+      const float dirY = diffY > 0.f ? 1.f : -1.f;
+      constexpr float spd = 50.f;
+      e.x += dirX * spd * dt;
+      e.y += dirY * spd * dt;
+      if (fabsf(diffX) < 10.f && fabsf(diffY) < 10.f)
+      {
+        e.targetX = (rand() % 40 - 20) * 15.f;
+        e.targetY = (rand() % 40 - 20) * 15.f;
+      }
+    }
+  }
+  for (const Entity &e : entities)
+  {
+    for (size_t i = 0; i < server->peerCount; ++i)
     {
-      e.x = x;
-      e.y = y;
+      ENetPeer *peer = &server->peers[i];
+      if (handle_eid(controlledByPeer[i]) != e.eid)
+        send_snapshot(peer, e.eid, e.x, e.y);
     }
+  }
 }
 
 int main(int argc, const char **argv)
@@ -75,6 +110,7 @@ int main(int argc, const char **argv)
     printf("Cannot create ENet server\n");
     return 1;
   }
+  controlledByPeer.resize(server->peerCount, invalid_handle);
 
   constexpr int numAi = 10;
 
@@ -82,15 +118,13 @@ int main(int argc, const char **argv)
   {
     uint16_t eid = create_random_entity();
     entities[eid].serverControlled = true;
-    controlledMap[eid] = nullptr;
   }
 
-  uint32_t lastTime = enet_time_get();
+  // sleeps between ticks unless there is network traffic to handle
+  FixedTimestep timestep(60.f);
+  EventLoop eventLoop(server);
   while (true)
   {
-    uint32_t curTime = enet_time_get();
-    float dt = (curTime - lastTime) * 0.001f;
-    lastTime = curTime;
     ENetEvent event;
     while (enet_host_service(server, &event, 0) > 0)
     {
@@ -115,34 +149,14 @@ int main(int argc, const char **argv)
         break;
       };
     }
-    for (Entity &e : entities)
+    for (uint32_t due = timestep.advance(); due > 0; --due)
     {
-      if (e.serverControlled)
-      {
-        const float diffX = e.targetX - e.x;
-        const float diffY = e.targetY - e.y;
-        const float dirX = diffX > 0.f ? 1.f : -1.f;
-        const float dirY = diffY > 0.f ? 1.f : -1.f;
-        constexpr float spd = 50.f;
-        e.x += dirX * spd * dt;
-        e.y += dirY * spd * dt;
-        if (fabsf(diffX) < 10.f && fabsf(diffY) < 10.f)
-        {
-          e.targetX = (rand() % 40 - 20) * 15.f;
-          e.targetY = (rand() % 40 - 20) * 15.f;
-        }
-      }
-    }
-    for (const Entity &e : entities)
-    {
-      for (size_t i = 0; i < server->peerCount; ++i)
-      {
-        ENetPeer *peer = &server->peers[i];
-        if (controlledMap[e.eid] != peer)
-          send_snapshot(peer, e.eid, e.x, e.y);
-      }
+      const uint64_t tickStart = get_time_nsec();
+      simulate_world(server, timestep.dt());
+      timestep.end_tick(get_time_nsec() - tickStart);
     }
-    //usleep(400000);
+    enet_host_flush(server);
+    eventLoop.wait(timestep.time_to_next_tick());
   }
 
   enet_host_destroy(server);
@@ -0,0 +1,74 @@
+#pragma once
+#include <cstdint>
+#include <chrono>
+#include <algorithm>
+
+// monotonic, not affected by wall clock adjustments
+inline uint64_t get_time_nsec()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct TickStats
+{
+  uint32_t ticks = 0;
+  uint32_t overruns = 0; // ticks that took longer than their budget
+  uint32_t droppedTicks = 0; // time given up on after falling too far behind
+  uint64_t totalWorkNsec = 0;
+  uint64_t maxWorkNsec = 0;
+};
+
+// Real time goes into an accumulator and comes out in whole ticks, so the
+// simulation always advances by exactly the same dt no matter how the loop
+// around it is scheduled.
+struct FixedTimestep
+{
+  uint64_t tickNsec;
+  uint64_t accumulator = 0;
+  uint64_t lastTime;
+  uint32_t tick = 0;
+  // after a stall catch up at most this many ticks at once, drop the rest
+  uint32_t maxCatchUpTicks = 8;
+  TickStats stats;
+
+  explicit FixedTimestep(float hz) : tickNsec(uint64_t(1e9 / hz)), lastTime(get_time_nsec()) {}
+
+  float dt() const { return tickNsec * 1e-9f; }
+  // simulation time of the current tick
+  uint32_t time_msec() const { return uint32_t(uint64_t(tick) * tickNsec / 1000000); }
+
+  // number of ticks due since the last call
+  uint32_t advance()
+  {
+    const uint64_t now = get_time_nsec();
+    accumulator += now - lastTime;
+    lastTime = now;
+    uint64_t due = accumulator / tickNsec;
+    if (due > maxCatchUpTicks)
+    {
+      stats.droppedTicks += due - maxCatchUpTicks;
+      accumulator -= (due - maxCatchUpTicks) * tickNsec;
+      due = maxCatchUpTicks;
+    }
+    return uint32_t(due);
+  }
+
+  // consumes one tick from the accumulator, `work_nsec` is how long it took
+  void end_tick(uint64_t work_nsec)
+  {
+    accumulator -= tickNsec;
+    ++tick;
+    ++stats.ticks;
+    stats.totalWorkNsec += work_nsec;
+    stats.maxWorkNsec = std::max(stats.maxWorkNsec, work_nsec);
+    if (work_nsec > tickNsec)
+      ++stats.overruns;
+  }
+
+  uint64_t time_to_next_tick() const
+  {
+    const uint64_t pending = accumulator + (get_time_nsec() - lastTime);
+    return pending >= tickNsec ? 0 : tickNsec - pending;
+  }
+};
@@ -3,12 +3,15 @@
 #include "entity.h"
 #include "protocol.h"
 #include "mathUtils.h"
+#include "fixedTimestep.h"
+#include "eventLoop.h"
+#include "entityRegistry.h"
 #include <stdlib.h>
 #include <vector>
-#include <map>
 
 static std::vector<Entity> entities;
-static std::map<uint16_t, ENetPeer*> controlledMap;
+static EntityRegistry registry; // eid -> index into `entities`
+static EidAllocator eidAllocator;
 
 void on_join(ENetPacket *packet, ENetPeer *peer, ENetHost *host)
 {
@@ -16,11 +19,9 @@ void on_join(ENetPacket *packet, ENetPeer *peer, ENetHost *host)
   for (const Entity &ent : entities)
     send_new_entity(peer, ent);
 
-  // find max eid
-  uint16_t maxEid = entities.empty() ? invalid_entity : entities[0].eid;
-  for (const Entity &e : entities)
-    maxEid = std::max(maxEid, e.eid);
-  uint16_t newEid = maxEid + 1;
+  uint16_t newEid = eidAllocator.allocate(0);
+  if (newEid == invalid_entity)
+    return; // the world is full
   uint32_t color = 0xff000000 +
                    0x00440000 * (rand() % 5) +
                    0x00004400 * (rand() % 5) +
@@ -28,11 +29,9 @@ void on_join(ENetPacket *packet, ENetPeer *peer, ENetHost *host)
   float x = (rand() % 4) * 5.f;
   float y = (rand() % 4) * 5.f;
   Entity ent = {color, x, y, 0.f, (rand() / RAND_MAX) * 3.141592654f, 0.f, 0.f, 0.f, 0.f, newEid};
+  registry.insert(newEid);
   entities.push_back(ent);
 
-  controlledMap[newEid] = peer;
-
-
   // send info about new entity to everyone
   for (size_t i = 0; i < host->peerCount; ++i)
     send_new_entity(&host->peers[i], ent);
@@ -45,12 +44,11 @@ void on_input(ENetPacket *packet)
   uint16_t eid = invalid_entity;
   float thr = 0.f; float steer = 0.f;
   deserialize_entity_input(packet, eid, thr, steer);
-  for (Entity &e : entities)
-    if (e.eid == eid)
-    {
-      e.thr = thr;
-      e.steer = steer;
-    }
+  const uint32_t idx = registry.find_eid(eid);
+  if (idx == EntityRegistry::npos)
+    return;
+  entities[idx].thr = thr;
+  entities[idx].steer = steer;
 }
 
 static void update_net(ENetHost* server)
@@ -91,8 +89,7 @@ static void simulate_world(ENetHost* server, float dt)
     for (size_t i = 0; i < server->peerCount; ++i)
     {
       ENetPeer *peer = &server->peers[i];
-      // skip this here in this implementation
-      //if (controlledMap[e.eid] != peer)
+      // the peer's own ship is not skipped here in this implementation
       send_snapshot(peer, e.eid, e.x, e.y, e.ori);
     }
   }
@@ -125,20 +122,24 @@ int main(int argc, const char **argv)
     return 1;
   }
 
-  uint32_t lastTime = enet_time_get();
+  // the world ticks at 10 Hz, network traffic is handled as it arrives
+  FixedTimestep timestep(10.f);
+  EventLoop eventLoop(server);
   while (true)
   {
-    uint32_t curTime = enet_time_get();
-    float dt = (curTime - lastTime) * 0.001f;
-    lastTime = curTime;
-
     update_net(server);
-    simulate_world(server, dt);
-    update_time(server, curTime);
-
-    printf("%d\n", curTime);
+    for (uint32_t due = timestep.advance(); due > 0; --due)
+    {
+      const uint64_t tickStart = get_time_nsec();
+      uint32_t curTime = enet_time_get();
+      simulate_world(server, timestep.dt());
+      update_time(server, curTime);
 
-    usleep(100000);
+      printf("%d\n", curTime);
+      timestep.end_tick(get_time_nsec() - tickStart);
+    }
+    enet_host_flush(server);
+    eventLoop.wait(timestep.time_to_next_tick());
   }
 
   enet_host_destroy(server);
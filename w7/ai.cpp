@@ -0,0 +1,19 @@
+#include "ai.h"
+#include "rng.h"
+
+void update_ai(EntityStore &store, size_t first, size_t count, uint32_t tick, uint64_t seed)
+{
+  for (size_t i = first; i < first + count; ++i)
+  {
+    if (!store.serverControlled[i])
+      continue;
+    // every ship has its own stream, one draw per tick
+    const uint64_t r = rng_at(seed, store.eid[i], tick);
+    // small random chance to enable or disable throttle
+    if ((r & 0xffff) % 100 == 0)
+      store.thr[i] = store.thr[i] > 0.f ? 0.f : 1.f;
+    // small random chance to enable or disable steering
+    if ((r >> 16 & 0xffff) % 10 == 0)
+      store.steer[i] = store.steer[i] != 0.f ? 0.f : ((r >> 32 & 1) * 2.f - 1.f);
+  }
+}
@@ -0,0 +1,10 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include "entityStore.h"
+
+// Steers the server controlled ships among [first, first + count). Every
+// decision only depends on the world seed, the ship's eid and the tick, never
+// on the order ships are visited in, so any split of the world across threads
+// gives the same result and the same seed replays the same session.
+void update_ai(EntityStore &store, size_t first, size_t count, uint32_t tick, uint64_t seed);
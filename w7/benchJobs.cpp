@@ -0,0 +1,100 @@
+// How the parallel AI + simulation step scales with threads, and that it ends
+// up in exactly the same world no matter how many threads ran it.
+// usage: w7_bench_jobs [max threads, default one per core]
+#include "ai.h"
+#include "entityStore.h"
+#include "jobSystem.h"
+#include "mathUtils.h"
+#include "rng.h"
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+constexpr size_t simulationChunk = 1024;
+
+// eids only have 16 bits, a world this big skips the registry
+static void fill_world(EntityStore &store, size_t count)
+{
+  Rng rng(1);
+  for (size_t i = 0; i < count; ++i)
+  {
+    store.x.push_back(rng.uniform(-worldSize, worldSize));
+    store.y.push_back(rng.uniform(-worldSize, worldSize));
+    store.vx.push_back(0.f);
+    store.vy.push_back(0.f);
+    store.ori.push_back(rng.uniform(-PI, PI));
+    store.omega.push_back(0.f);
+    store.thr.push_back(0.f);
+    store.steer.push_back(0.f);
+    store.color.push_back(0xffffffff);
+    store.serverControlled.push_back(1);
+    store.eid.push_back(uint16_t(i));
+  }
+}
+
+// FNV-1a over the raw bits of the simulated state
+static uint64_t world_checksum(const EntityStore &store)
+{
+  uint64_t hash = 0xcbf29ce484222325ull;
+  auto mix = [&](const AlignedVector<float> &values)
+  {
+    const uint8_t *bytes = reinterpret_cast<const uint8_t*>(values.data());
+    for (size_t i = 0; i < values.size() * sizeof(float); ++i)
+      hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+  };
+  mix(store.x);
+  mix(store.y);
+  mix(store.vx);
+  mix(store.vy);
+  mix(store.ori);
+  mix(store.omega);
+  mix(store.thr);
+  mix(store.steer);
+  return hash;
+}
+
+int main(int argc, const char **argv)
+{
+  size_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+  if (argc > 1)
+    maxThreads = std::max(1, atoi(argv[1]));
+
+  const size_t worldSizes[] = {10000, 100000, 1000000};
+  bool deterministic = true;
+  for (size_t numEntities : worldSizes)
+  {
+    // roughly the same amount of work per measurement
+    const uint32_t ticks = uint32_t(std::max<size_t>(10, 5000000 / numEntities));
+    double singleThreadMsec = 0.0;
+    uint64_t reference = 0;
+    for (size_t numThreads = 1; numThreads <= maxThreads; ++numThreads)
+    {
+      EntityStore store;
+      fill_world(store, numEntities);
+      JobSystem jobs(numThreads);
+      const auto start = std::chrono::steady_clock::now();
+      for (uint32_t tick = 0; tick < ticks; ++tick)
+        jobs.parallel_for(store.size(), simulationChunk, [&](size_t first, size_t count)
+        {
+          update_ai(store, first, count, tick, 1);
+          simulate_entities(store, first, count, 1.f / 60.f);
+        });
+      const double msec = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()
+                          / ticks;
+      const uint64_t checksum = world_checksum(store);
+      if (numThreads == 1)
+      {
+        singleThreadMsec = msec;
+        reference = checksum;
+      }
+      const bool same = checksum == reference;
+      deterministic = deterministic && same;
+      printf("%8zu entities %2zu threads: %8.3f ms/tick, %5.2fx, %6.2f ns/entity, checksum %016llx%s\n",
+             numEntities, numThreads, msec, singleThreadMsec / msec, msec * 1e6 / numEntities,
+             (unsigned long long)checksum, same ? "" : " MISMATCH");
+    }
+  }
+  return deterministic ? 0 : 1;
+}
@@ -0,0 +1,191 @@
+// Accuracy of fast_sincos/wrap_coord against libm and how fast they and the
+// batch simulation are. Exits with 1 if the approximation is off by more than
+// the bound mathUtils.h promises.
+#include "mathUtils.h"
+#include "entity.h"
+#include "entityStore.h"
+#include <chrono>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+constexpr float sincosErrorBound = 1e-7f;
+constexpr float sincosRange = 8192.f;
+
+static double now_nsec()
+{
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// keeps the optimiser from throwing away results nobody reads
+static volatile float sink;
+
+template<typename Callable>
+static double time_per_item(size_t items, int repeats, Callable c)
+{
+  c(); // warm up
+  const double start = now_nsec();
+  for (int i = 0; i < repeats; ++i)
+    c();
+  return (now_nsec() - start) / (double(items) * repeats);
+}
+
+static bool check_accuracy()
+{
+  double maxErr = 0.0;
+  double maxErrPi = 0.0;
+  float worstX = 0.f;
+  size_t simdMismatches = 0;
+  constexpr size_t steps = 1 << 24;
+  for (size_t i = 0; i < steps; ++i)
+  {
+    const float x = -sincosRange + 2.f * sincosRange * float(i) / steps;
+    float s, c;
+    fast_sincos(x, s, c);
+    const double err = fmax(fabs(double(s) - sin(double(x))), fabs(double(c) - cos(double(x))));
+    if (err > maxErr)
+    {
+      maxErr = err;
+      worstX = x;
+    }
+    if (fabsf(x) <= PI)
+      maxErrPi = fmax(maxErrPi, err);
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    __m128 vs, vc;
+    fast_sincos(_mm_set1_ps(x), vs, vc);
+    if (_mm_cvtss_f32(vs) != s || _mm_cvtss_f32(vc) != c)
+      ++simdMismatches;
+#endif
+  }
+  // the libm float versions are not exact either, for reference
+  double libmErr = 0.0;
+  for (size_t i = 0; i < steps; i += 16)
+  {
+    const float x = -sincosRange + 2.f * sincosRange * float(i) / steps;
+    libmErr = fmax(libmErr, fmax(fabs(double(sinf(x)) - sin(double(x))), fabs(double(cosf(x)) - cos(double(x)))));
+  }
+  printf("fast_sincos: max error %.3g (at %g), %.3g within [-pi, pi], sinf/cosf %.3g, %zu SIMD mismatches\n",
+         maxErr, worstX, maxErrPi, libmErr, simdMismatches);
+
+  size_t wrapMismatches = 0;
+  for (size_t i = 0; i < steps; ++i)
+  {
+    const float v = -3.f * worldSize + 6.f * worldSize * float(i) / steps;
+    const float w = wrap_coord(v, worldSize);
+    if (w < -worldSize || w > worldSize || fabsf(remainderf(w - v, 2.f * worldSize)) > 1e-4f)
+      ++wrapMismatches;
+  }
+  printf("wrap_coord: %zu results off the torus\n", wrapMismatches);
+  return maxErr <= sincosErrorBound && simdMismatches == 0 && wrapMismatches == 0;
+}
+
+static void benchmark()
+{
+  constexpr size_t count = 1 << 16;
+  constexpr int repeats = 200;
+  std::vector<float> angles(count);
+  for (size_t i = 0; i < count; ++i)
+    angles[i] = (rand() / float(RAND_MAX) * 2.f - 1.f) * PI;
+
+  const double libm = time_per_item(count, repeats, [&]()
+  {
+    float acc = 0.f;
+    for (float a : angles)
+      acc += sinf(a) + cosf(a);
+    sink = acc;
+  });
+  const double scalar = time_per_item(count, repeats, [&]()
+  {
+    float acc = 0.f;
+    for (float a : angles)
+    {
+      float s, c;
+      fast_sincos(a, s, c);
+      acc += s + c;
+    }
+    sink = acc;
+  });
+  printf("sinf+cosf %.2f ns, fast_sincos %.2f ns", libm, scalar);
+#if defined(__AVX2__)
+  const double simd = time_per_item(count, repeats, [&]()
+  {
+    __m256 acc = _mm256_setzero_ps();
+    for (size_t i = 0; i < count; i += 8)
+    {
+      __m256 s, c;
+      fast_sincos(_mm256_loadu_ps(&angles[i]), s, c);
+      acc = _mm256_add_ps(acc, _mm256_add_ps(s, c));
+    }
+    sink = _mm_cvtss_f32(_mm256_castps256_ps128(acc));
+  });
+  printf(", AVX2 %.2f ns", simd);
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  const double simd = time_per_item(count, repeats, [&]()
+  {
+    __m128 acc = _mm_setzero_ps();
+    for (size_t i = 0; i < count; i += 4)
+    {
+      __m128 s, c;
+      fast_sincos(_mm_loadu_ps(&angles[i]), s, c);
+      acc = _mm_add_ps(acc, _mm_add_ps(s, c));
+    }
+    sink = _mm_cvtss_f32(acc);
+  });
+  printf(", SSE2 %.2f ns", simd);
+#endif
+  printf(" per angle\n");
+
+  const double branchy = time_per_item(count, repeats, [&]()
+  {
+    float acc = 0.f;
+    for (float a : angles)
+      acc += wrap_delta(a * 2.f, PI);
+    sink = acc;
+  });
+  const double branchless = time_per_item(count, repeats, [&]()
+  {
+    float acc = 0.f;
+    for (float a : angles)
+      acc += wrap_coord(a * 2.f, PI);
+    sink = acc;
+  });
+  printf("wrap_delta %.2f ns, wrap_coord %.2f ns per value\n", branchy, branchless);
+
+  constexpr size_t numEntities = 100000;
+  constexpr int ticks = 100;
+  EntityStore store;
+  std::vector<Entity> entities(numEntities);
+  for (size_t i = 0; i < numEntities; ++i)
+  {
+    Entity &e = entities[i];
+    e.x = (rand() / float(RAND_MAX) * 2.f - 1.f) * worldSize;
+    e.y = (rand() / float(RAND_MAX) * 2.f - 1.f) * worldSize;
+    e.ori = angles[i % count];
+    e.thr = float(rand() % 3 - 1);
+    e.steer = float(rand() % 3 - 1);
+    e.eid = uint16_t(i);
+    store.push_back(e);
+  }
+  const double perEntity = time_per_item(numEntities, ticks, [&]()
+  {
+    for (Entity &e : entities)
+      simulate_entity(e, 1.f / 60.f);
+  });
+  const double scalarBatch = time_per_item(numEntities, ticks, [&]()
+  {
+    simulate_entities_scalar(store, 0, store.size(), 1.f / 60.f);
+  });
+  const double batch = time_per_item(numEntities, ticks, [&]()
+  {
+    simulate_entities(store, 1.f / 60.f);
+  });
+  printf("simulate_entity %.2f ns, simulate_entities_scalar %.2f ns, simulate_entities %.2f ns per entity\n",
+         perEntity, scalarBatch, batch);
+}
+
+int main()
+{
+  const bool accurate = check_accuracy();
+  benchmark();
+  return accurate ? 0 : 1;
+}
@@ -0,0 +1,331 @@
+// Encode and decode cost of every message in protocol.cpp and of the float
+// quantisation under them. Packets go to an in-memory sink instead of ENet, so
+// no sockets are involved. Prints JSON, to keep and diff when a codec changes.
+// usage: w7_bench_protocol [iterations, default 100000]
+#include "protocol.h"
+#include "messageSchema.h"
+#include "quantisation.h"
+#include "memoryPool.h"
+#include "rng.h"
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+constexpr size_t numShips = 100;
+constexpr size_t numPeers = 8;
+
+// keeps the optimiser from throwing away results nobody reads
+static volatile uint32_t sink;
+
+static double now_nsec()
+{
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// keeps the last packet for the decoders, frees the one before
+struct CaptureSink
+{
+  ENetPacket *packet = nullptr;
+  size_t bytes = 0;
+};
+
+static void capture_packet(void *user, ENetPeer *, uint8_t, ENetPacket *packet, bool last)
+{
+  if (!last)
+    return;
+  CaptureSink &capture = *(CaptureSink*)user;
+  capture.bytes += packet->dataLength;
+  if (capture.packet)
+    enet_packet_destroy(capture.packet);
+  capture.packet = packet;
+}
+
+struct BenchResult
+{
+  const char *name;
+  double nsPerOp;
+  double bytesPerOp;
+};
+
+static std::vector<BenchResult> results;
+static CaptureSink capture;
+static size_t iterations = 100000;
+
+// an encoder, bytes are whatever reached the sink
+template<typename Callable>
+static void bench_send(const char *name, Callable c)
+{
+  c(); // warm up
+  capture.bytes = 0;
+  const double start = now_nsec();
+  for (size_t i = 0; i < iterations; ++i)
+    c();
+  const double elapsed = now_nsec() - start;
+  results.push_back({name, elapsed / iterations, double(capture.bytes) / iterations});
+}
+
+// a decoder, run on the packet the last encoder produced
+template<typename Callable>
+static void bench_receive(const char *name, Callable c)
+{
+  ENetPacket *packet = capture.packet;
+  c(packet);
+  const double start = now_nsec();
+  for (size_t i = 0; i < iterations; ++i)
+    c(packet);
+  const double elapsed = now_nsec() - start;
+  results.push_back({name, elapsed / iterations, double(packet->dataLength)});
+}
+
+// pure functions, `c(i)` gets a different input every call
+template<typename Callable>
+static void bench_pure(const char *name, double bytes, Callable c)
+{
+  uint32_t acc = 0;
+  const double start = now_nsec();
+  for (size_t i = 0; i < iterations; ++i)
+    acc += c(i);
+  const double elapsed = now_nsec() - start;
+  sink = acc;
+  results.push_back({name, elapsed / iterations, bytes});
+}
+
+static void print_json()
+{
+  printf("{\n  \"bench\": \"w7_protocol\",\n  \"iterations\": %zu,\n  \"results\": [\n", iterations);
+  for (size_t i = 0; i < results.size(); ++i)
+    printf("    {\"name\": \"%s\", \"ns_per_op\": %.2f, \"bytes_per_op\": %.2f}%s\n", results[i].name,
+           results[i].nsPerOp, results[i].bytesPerOp, i + 1 < results.size() ? "," : "");
+  printf("  ]\n}\n");
+}
+
+static std::vector<Entity> make_ships(Rng &rng)
+{
+  std::vector<Entity> ships(numShips);
+  for (size_t i = 0; i < ships.size(); ++i)
+  {
+    Entity &e = ships[i];
+    e.color = rng.next();
+    e.serverControlled = true;
+    e.x = rng.uniform(-worldSize, worldSize);
+    e.y = rng.uniform(-worldSize, worldSize);
+    e.vx = rng.uniform(-5.f, 5.f);
+    e.vy = rng.uniform(-5.f, 5.f);
+    e.ori = rng.uniform(-PI, PI);
+    e.omega = rng.uniform(-1.f, 1.f);
+    e.thr = 1.f;
+    e.steer = float(int(rng.below(3)) - 1);
+    e.eid = uint16_t(i);
+  }
+  return ships;
+}
+
+static std::vector<EntityRecord> make_records(const std::vector<Entity> &ships, uint32_t time)
+{
+  std::vector<EntityRecord> records;
+  for (const Entity &e : ships)
+    records.push_back(pack_entity_record(e, time));
+  return records;
+}
+
+static void bench_messages()
+{
+  Rng rng(1);
+  ENetPeer peers[numPeers] = {};
+  ENetPeer *peerPtrs[numPeers];
+  for (size_t i = 0; i < numPeers; ++i)
+    peerPtrs[i] = &peers[i];
+  ENetPeer *peer = &peers[0];
+  std::vector<Entity> ships = make_ships(rng);
+  const Entity &ship = ships[0];
+
+  bench_send("send_join", [&]() { send_join(peer); });
+
+  bench_send("send_new_entity", [&]() { send_new_entity(peer, ship); });
+  bench_receive("deserialize_new_entity", [](ENetPacket *packet)
+  {
+    Entity e;
+    deserialize_new_entity(packet, e);
+    sink = e.eid;
+  });
+  bench_send("send_new_entity_shared_8", [&]() { send_new_entity(peerPtrs, numPeers, ship); });
+
+  bench_send("send_remove_entity", [&]() { send_remove_entity(peer, ship.eid); });
+  bench_receive("deserialize_remove_entity", [](ENetPacket *packet)
+  {
+    uint16_t eid;
+    deserialize_remove_entity(packet, eid);
+    sink = eid;
+  });
+
+  bench_send("send_set_controlled_entity", [&]() { send_set_controlled_entity(peer, ship.eid); });
+  bench_receive("deserialize_set_controlled_entity", [](ENetPacket *packet)
+  {
+    uint16_t eid;
+    deserialize_set_controlled_entity(packet, eid);
+    sink = eid;
+  });
+
+  uint16_t inputSeq = 0;
+  bench_send("send_entity_input", [&]() { send_entity_input(peer, ship.eid, inputSeq++, 1.f, -1.f); });
+  bench_receive("deserialize_entity_input", [](ENetPacket *packet)
+  {
+    uint16_t eid, seq;
+    float thr, steer;
+    deserialize_entity_input(packet, eid, seq, thr, steer);
+    sink = seq;
+  });
+
+  bench_send("send_snapshot", [&]() { send_snapshot(peer, ship.eid, ship.x, ship.y, ship.ori); });
+  bench_receive("deserialize_snapshot", [](ENetPacket *packet)
+  {
+    uint16_t eid;
+    float x, y, ori;
+    deserialize_snapshot(packet, eid, x, y, ori);
+    sink = eid;
+  });
+
+  // a full snapshot of every ship, then a delta against it three ticks later
+  const std::vector<EntityRecord> fullRecords = make_records(ships, 0);
+  SnapshotFrame sent;
+  sent.seq = 1;
+  bench_send("send_world_snapshot_full_100", [&]()
+  {
+    get_frame_arena().reset();
+    sent.records.clear();
+    send_world_snapshot(peer, nullptr, fullRecords, sent);
+  });
+  SnapshotHistory history;
+  SnapshotFrame received;
+  bench_receive("deserialize_world_snapshot_full_100", [&](ENetPacket *packet)
+  {
+    deserialize_world_snapshot(packet, history, received);
+    sink = uint32_t(received.records.size());
+  });
+
+  SnapshotFrame &baseline = history.push(sent.seq);
+  baseline.records = sent.records;
+  for (Entity &e : ships)
+    for (int i = 0; i < 3; ++i)
+      simulate_entity(e, 1.f / 60.f);
+  const std::vector<EntityRecord> deltaRecords = make_records(ships, 50);
+  SnapshotFrame deltaSent;
+  deltaSent.seq = 2;
+  deltaSent.serverTime = 50;
+  bench_send("send_world_snapshot_delta_100", [&]()
+  {
+    get_frame_arena().reset();
+    deltaSent.records.clear();
+    send_world_snapshot(peer, &baseline, deltaRecords, deltaSent);
+  });
+  bench_receive("deserialize_world_snapshot_delta_100", [&](ENetPacket *packet)
+  {
+    deserialize_world_snapshot(packet, history, received);
+    sink = uint32_t(received.records.size());
+  });
+
+  bench_send("send_snapshot_ack", [&]() { send_snapshot_ack(peer, 2); });
+  bench_receive("deserialize_snapshot_ack", [](ENetPacket *packet)
+  {
+    uint16_t seq;
+    deserialize_snapshot_ack(packet, seq);
+    sink = seq;
+  });
+
+  uint32_t timeMsec = 0;
+  bench_send("send_time_msec", [&]() { send_time_msec(peer, timeMsec += 16); });
+  bench_receive("deserialize_time_msec", [](ENetPacket *packet)
+  {
+    uint32_t msec;
+    deserialize_time_msec(packet, msec);
+    sink = msec;
+  });
+
+  LockstepWorld world;
+  world.reset(1, 0, lockstep_dt(60));
+  for (const Entity &e : ships)
+    world.spawn(to_lockstep_entity(e));
+  bench_send("send_lockstep_state_100", [&]()
+  {
+    get_frame_arena().reset();
+    send_lockstep_state(peer, world);
+  });
+  LockstepWorld receivedWorld;
+  bench_receive("deserialize_lockstep_state_100", [&](ENetPacket *packet)
+  {
+    deserialize_lockstep_state(packet, receivedWorld);
+    sink = uint32_t(receivedWorld.entities.size());
+  });
+
+  // what a tick with a few players pressing keys looks like
+  LockstepFrame frame;
+  frame.tick = 30;
+  for (uint16_t eid = 0; eid < 4; ++eid)
+    frame.inputs.push_back({eid, 1, int8_t(eid % 3 - 1)});
+  frame.hasChecksum = true;
+  frame.checksum = world.checksum();
+  bench_send("send_lockstep_frame_shared_8", [&]()
+  {
+    get_frame_arena().reset();
+    send_lockstep_frame(peerPtrs, numPeers, frame);
+  });
+  LockstepFrame receivedFrame;
+  bench_receive("deserialize_lockstep_frame", [&](ENetPacket *packet)
+  {
+    deserialize_lockstep_frame(packet, receivedFrame);
+    sink = receivedFrame.tick;
+  });
+
+  bench_send("send_lockstep_resync", [&]() { send_lockstep_resync(peer); });
+  bench_receive("get_packet_type", [](ENetPacket *packet) { sink = get_packet_type(packet); });
+}
+
+static void bench_quantisation()
+{
+  std::vector<float> values(1024);
+  Rng rng(2);
+  for (float &v : values)
+    v = rng.uniform(-worldSize, worldSize);
+  const size_t mask = values.size() - 1;
+
+  bench_pure("pack_float_11", 11 / 8.0, [&](size_t i)
+  {
+    return uint32_t(pack_float<uint16_t>(values[i & mask], -worldSize, worldSize, 11));
+  });
+  bench_pure("unpack_float_11", 11 / 8.0, [&](size_t i)
+  {
+    return uint32_t(unpack_float<uint16_t>(uint16_t(i & 2047), -worldSize, worldSize, 11) > 0.f);
+  });
+  bench_pure("PackedFloat_11_round_trip", 11 / 8.0, [&](size_t i)
+  {
+    PositionXQuantized packed(values[i & mask], -worldSize, worldSize);
+    return uint32_t(packed.unpack(-worldSize, worldSize) > values[i & mask]);
+  });
+  bench_pure("PackedFloat_8_round_trip", 1.0, [&](size_t i)
+  {
+    OrientationQuantized packed(values[i & mask] / worldSize * PI, -PI, PI);
+    return uint32_t(packed.packedVal);
+  });
+}
+
+int main(int argc, const char **argv)
+{
+  if (argc > 1)
+    iterations = std::max(1, atoi(argv[1]));
+  if (enet_initialize() != 0)
+  {
+    printf("Cannot init ENet");
+    return 1;
+  }
+  packetSink = {capture_packet, &capture};
+  bench_messages();
+  bench_quantisation();
+  print_json();
+
+  if (capture.packet)
+    enet_packet_destroy(capture.packet);
+  atexit(enet_deinitialize);
+  return 0;
+}
@@ -0,0 +1,74 @@
+// What a random number costs: rand() and std::mt19937 against the Rng streams
+// and the counter based rng_at, on one thread and on every core at once, where
+// rand() has to share its state.
+// usage: w7_bench_rng [threads, default one per core]
+#include "rng.h"
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+constexpr uint32_t drawsPerThread = 1 << 24;
+
+// keeps the optimiser from throwing away results nobody reads
+static volatile uint32_t sink;
+
+static double now_nsec()
+{
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// ns per draw with `num_threads` threads each drawing `drawsPerThread` numbers
+template<typename MakeDraw>
+static double time_per_draw(size_t num_threads, MakeDraw make_draw)
+{
+  std::vector<std::thread> threads;
+  const double start = now_nsec();
+  for (size_t t = 0; t < num_threads; ++t)
+    threads.emplace_back([&, t]()
+    {
+      auto draw = make_draw(uint32_t(t));
+      uint32_t acc = 0;
+      for (uint32_t i = 0; i < drawsPerThread; ++i)
+        acc += draw(i);
+      sink = acc;
+    });
+  for (std::thread &thread : threads)
+    thread.join();
+  return (now_nsec() - start) / (double(drawsPerThread) * num_threads);
+}
+
+static void run(size_t num_threads)
+{
+  const double libc = time_per_draw(num_threads, [](uint32_t)
+  {
+    return [](uint32_t) { return uint32_t(rand()); };
+  });
+  const double mt = time_per_draw(num_threads, [](uint32_t t)
+  {
+    return [gen = std::mt19937(t)](uint32_t) mutable { return uint32_t(gen()); };
+  });
+  const double stream = time_per_draw(num_threads, [](uint32_t t)
+  {
+    return [rng = Rng(1, t)](uint32_t) mutable { return rng.next(); };
+  });
+  const double counter = time_per_draw(num_threads, [](uint32_t t)
+  {
+    return [t](uint32_t i) { return uint32_t(rng_at(1, t, i)); };
+  });
+  printf("%2zu threads: rand %.2f ns, mt19937 %.2f ns, Rng::next %.2f ns, rng_at %.2f ns per draw\n",
+         num_threads, libc, mt, stream, counter);
+}
+
+int main(int argc, const char **argv)
+{
+  size_t numThreads = std::max(1u, std::thread::hardware_concurrency());
+  if (argc > 1)
+    numThreads = std::max(1, atoi(argv[1]));
+  run(1);
+  if (numThreads > 1)
+    run(numThreads);
+  return 0;
+}
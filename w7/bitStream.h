@@ -0,0 +1,142 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include "quantisation.h"
+
+// Packs values LSB first with no byte alignment. Writes that don't fit into
+// the buffer are dropped and flagged instead of overrunning it.
+struct BitWriter
+{
+  uint8_t *data = nullptr;
+  size_t capacity = 0;
+  size_t bytePos = 0;
+  uint64_t scratch = 0;
+  int scratchBits = 0;
+  bool overflow = false;
+
+  BitWriter(uint8_t *data, size_t capacity) : data(data), capacity(capacity) {}
+
+  void write_bits(uint32_t value, int num_bits)
+  {
+    if (num_bits < 32)
+      value &= (1u << num_bits) - 1;
+    scratch |= uint64_t(value) << scratchBits;
+    scratchBits += num_bits;
+    while (scratchBits >= 8)
+    {
+      if (bytePos < capacity)
+        data[bytePos++] = uint8_t(scratch);
+      else
+        overflow = true;
+      scratch >>= 8;
+      scratchBits -= 8;
+    }
+  }
+
+  void write_bool(bool value) { write_bits(value ? 1 : 0, 1); }
+
+  // 7 bits per group and a continuation bit, small values stay small
+  void write_varint(uint32_t value)
+  {
+    while (value >= 0x80)
+    {
+      write_bits((value & 0x7f) | 0x80, 8);
+      value >>= 7;
+    }
+    write_bits(value, 8);
+  }
+
+  void write_float(float value)
+  {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(float));
+    write_bits(bits, 32);
+  }
+
+  template<typename T, int num_bits>
+  void write_packed(const PackedFloat<T, num_bits> &value) { write_bits(value.packedVal, num_bits); }
+
+  void write_quantized(float value, float lo, float hi, int num_bits)
+  {
+    write_bits(pack_float<uint32_t>(value, lo, hi, num_bits), num_bits);
+  }
+
+  size_t get_bits_written() const { return bytePos * 8 + scratchBits; }
+
+  // pads the last byte with zeros, returns the number of bytes used
+  size_t flush()
+  {
+    if (scratchBits > 0)
+      write_bits(0, 8 - scratchBits);
+    return bytePos;
+  }
+};
+
+// Reading past the end yields zeros and sets `overflow`, so a malformed packet
+// can be decoded completely and rejected once at the end.
+struct BitReader
+{
+  const uint8_t *data = nullptr;
+  size_t size = 0;
+  size_t bytePos = 0;
+  uint64_t scratch = 0;
+  int scratchBits = 0;
+  bool overflow = false;
+
+  BitReader(const uint8_t *data, size_t size) : data(data), size(size) {}
+
+  uint32_t read_bits(int num_bits)
+  {
+    while (scratchBits < num_bits)
+    {
+      if (bytePos >= size)
+      {
+        overflow = true;
+        scratch = 0;
+        scratchBits = 0;
+        return 0;
+      }
+      scratch |= uint64_t(data[bytePos++]) << scratchBits;
+      scratchBits += 8;
+    }
+    uint32_t value = uint32_t(scratch & ((uint64_t(1) << num_bits) - 1));
+    scratch >>= num_bits;
+    scratchBits -= num_bits;
+    return value;
+  }
+
+  bool read_bool() { return read_bits(1) != 0; }
+
+  uint32_t read_varint()
+  {
+    uint32_t value = 0;
+    for (int shift = 0; shift < 35; shift += 7)
+    {
+      uint32_t group = read_bits(8);
+      value |= (group & 0x7f) << shift;
+      if (!(group & 0x80))
+        return value;
+    }
+    overflow = true; // more groups than a 32 bit value can have
+    return 0;
+  }
+
+  float read_float()
+  {
+    uint32_t bits = read_bits(32);
+    float value;
+    memcpy(&value, &bits, sizeof(float));
+    return value;
+  }
+
+  template<typename T, int num_bits>
+  PackedFloat<T, num_bits> read_packed() { return PackedFloat<T, num_bits>(T(read_bits(num_bits))); }
+
+  float read_quantized(float lo, float hi, int num_bits)
+  {
+    return unpack_float<uint32_t>(read_bits(num_bits), lo, hi, num_bits);
+  }
+
+  size_t get_bits_remaining() const { return (size - bytePos) * 8 + scratchBits; }
+};
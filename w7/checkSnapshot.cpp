@@ -0,0 +1,113 @@
+// Runs a few seconds of snapshots for one peer through schedule_snapshot and
+// send_world_snapshot, once with a tight dead reckoning error and once with a
+// loose one. Exits with 1 unless the loose one keeps the ships the client can
+// extrapolate at their baseline and so sends fewer bytes.
+#include "snapshotScheduler.h"
+#include "protocol.h"
+#include "messageSchema.h"
+#include "memoryPool.h"
+#include "rng.h"
+#include <vector>
+#include <stdio.h>
+
+constexpr size_t numShips = 100;
+constexpr float tickRate = 60.f;
+constexpr uint32_t snapshotInterval = 3;
+constexpr uint32_t numTicks = 300;
+
+static void count_packet(void *user, ENetPeer *, uint8_t, ENetPacket *packet, bool last)
+{
+  *(size_t*)user += packet->dataLength;
+  if (last && packet->referenceCount == 0)
+    enet_packet_destroy(packet);
+}
+
+static EntityStore make_world()
+{
+  EntityStore store;
+  Rng rng(1);
+  for (size_t i = 0; i < numShips; ++i)
+  {
+    Entity e;
+    e.serverControlled = true;
+    e.x = rng.uniform(-worldSize, worldSize);
+    e.y = rng.uniform(-worldSize, worldSize);
+    e.ori = rng.uniform(-PI, PI);
+    e.vx = rng.uniform(-3.f, 3.f);
+    e.vy = rng.uniform(-3.f, 3.f);
+    // every other ship turns, the rest coast in a straight line
+    e.steer = i % 2 == 0 ? 1.f : 0.f;
+    e.eid = uint16_t(i);
+    store.push_back(e);
+  }
+  return store;
+}
+
+struct RunResult
+{
+  size_t bytes = 0;
+  // records left at their baseline although they fit the budget
+  size_t suppressed = 0;
+};
+
+static RunResult run(float dr_error)
+{
+  EntityStore entities = make_world();
+  DeadReckoningLimits limits;
+  limits.error = dr_error;
+
+  RunResult result;
+  packetSink = {count_packet, &result.bytes};
+  ENetPeer peer = {};
+  SnapshotHistory history;
+  uint16_t nextSeq = 0;
+  const SnapshotFrame *baseline = nullptr;
+  std::vector<uint32_t> visibleIdx;
+  for (uint32_t i = 0; i < numShips; ++i)
+    visibleIdx.push_back(i);
+  std::vector<float> priority(numShips, 0.f);
+  std::vector<EntityRecord> records;
+
+  for (uint32_t tick = 1; tick <= numTicks; ++tick)
+  {
+    get_frame_arena().reset();
+    simulate_entities(entities, 1.f / tickRate);
+    for (float &p : priority)
+      p += 1.f / tickRate;
+    if (tick % snapshotInterval != 0)
+      continue;
+    const uint32_t serverTime = uint32_t(tick * 1000.f / tickRate);
+    SnapshotFrame &sent = history.push(nextSeq++);
+    sent.serverTime = serverTime;
+    schedule_snapshot(entities, baseline, serverTime, visibleIdx, size_t(-1), limits,
+                      float(maxSnapshotPacketSize), records, priority);
+    if (baseline)
+      for (size_t i = 0; i < records.size(); ++i)
+        if (records[i].time != serverTime)
+          ++result.suppressed;
+    send_world_snapshot(&peer, baseline, records, sent);
+    // the client acks everything right away
+    baseline = &sent;
+  }
+  return result;
+}
+
+int main()
+{
+  if (enet_initialize() != 0)
+  {
+    printf("Cannot init ENet");
+    return 1;
+  }
+  const RunResult tight = run(0.01f);
+  const RunResult loose = run(1000.f);
+  printf("dr error 0.01: %zu bytes, %zu records kept at baseline\n", tight.bytes, tight.suppressed);
+  printf("dr error 1000: %zu bytes, %zu records kept at baseline\n", loose.bytes, loose.suppressed);
+  enet_deinitialize();
+  if (loose.suppressed == 0 || loose.bytes >= tight.bytes)
+  {
+    printf("FAILED: a looser dead reckoning error has to send less\n");
+    return 1;
+  }
+  return 0;
+}
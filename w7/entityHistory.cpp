@@ -0,0 +1,104 @@
+#include "entityHistory.h"
+#include "mathUtils.h"
+#include <algorithm>
+#include <math.h>
+
+EntityHistory::EntityHistory(size_t max_ticks, size_t max_entities, float border) :
+  maxTicks(max_ticks), maxEntities(max_entities), border(border),
+  states(max_ticks * max_entities), counts(max_ticks, 0), ticks(max_ticks, 0)
+{
+  saved.reserve(max_entities);
+}
+
+void EntityHistory::record(uint32_t tick, const EntityStore &entities)
+{
+  const size_t slot = tick % maxTicks;
+  EntityHistoryState *dst = &states[slot * maxEntities];
+  const size_t count = std::min(entities.size(), maxEntities);
+  for (size_t i = 0; i < count; ++i)
+    dst[i] = {entities.eid[i], entities.x[i], entities.y[i], entities.ori[i]};
+  // entities are usually kept in eid order already
+  auto byEid = [](const EntityHistoryState &a, const EntityHistoryState &b) { return a.eid < b.eid; };
+  if (!std::is_sorted(dst, dst + count, byEid))
+    std::sort(dst, dst + count, byEid);
+  counts[slot] = count;
+  ticks[slot] = tick;
+  newestTick = tick;
+  numRecorded = std::min<uint32_t>(numRecorded + 1, maxTicks);
+}
+
+uint32_t EntityHistory::oldest_tick() const
+{
+  return numRecorded == 0 ? newestTick : newestTick - (numRecorded - 1);
+}
+
+bool EntityHistory::has_tick(uint32_t tick) const
+{
+  if (numRecorded == 0 || uint32_t(newestTick - tick) >= numRecorded)
+    return false;
+  return ticks[tick % maxTicks] == tick;
+}
+
+const EntityHistoryState *EntityHistory::find_state(uint32_t tick, uint16_t eid) const
+{
+  const size_t slot = tick % maxTicks;
+  const EntityHistoryState *begin = &states[slot * maxEntities];
+  const EntityHistoryState *end = begin + counts[slot];
+  const EntityHistoryState *itf = std::lower_bound(begin, end, eid,
+    [](const EntityHistoryState &s, uint16_t eid) { return s.eid < eid; });
+  return itf != end && itf->eid == eid ? itf : nullptr;
+}
+
+bool EntityHistory::rewind(double tick, EntityStore &entities)
+{
+  const double whole = floor(tick);
+  const uint32_t from = uint32_t(int64_t(whole));
+  const float t = float(tick - whole);
+  if (!has_tick(from))
+    return false;
+  // the newest tick has nothing after it to interpolate towards
+  const uint32_t to = has_tick(from + 1) ? from + 1 : from;
+
+  saved.clear();
+  for (size_t i = 0; i < entities.size() && saved.size() < maxEntities; ++i)
+  {
+    const EntityHistoryState *a = find_state(from, entities.eid[i]);
+    const EntityHistoryState *b = find_state(to, entities.eid[i]);
+    if (!a && !b)
+      continue;
+    if (!a)
+      a = b;
+    if (!b)
+      b = a;
+    saved.push_back({uint32_t(i), entities.x[i], entities.y[i], entities.ori[i]});
+    float dx = b->x - a->x;
+    float dy = b->y - a->y;
+    if (border > 0.f)
+    {
+      dx = wrap_delta(dx, border);
+      dy = wrap_delta(dy, border);
+    }
+    float &x = entities.x[i];
+    float &y = entities.y[i];
+    x = a->x + dx * t;
+    y = a->y + dy * t;
+    if (border > 0.f)
+    {
+      x = wrap_delta(x, border);
+      y = wrap_delta(y, border);
+    }
+    entities.ori[i] = wrap_delta(a->ori + wrap_delta(b->ori - a->ori, PI) * t, PI);
+  }
+  return true;
+}
+
+void EntityHistory::restore(EntityStore &entities)
+{
+  for (const SavedState &s : saved)
+  {
+    entities.x[s.idx] = s.x;
+    entities.y[s.idx] = s.y;
+    entities.ori[s.idx] = s.ori;
+  }
+  saved.clear();
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "entityStore.h"
+
+// Lag compensation: positions of every entity over the last few ticks, so the
+// server can put the world back the way a client saw it when it acted, run its
+// checks and put it back. Storage is allocated up front, a fixed number of
+// entity slots per tick, rewinding only ever copies floats around.
+
+struct EntityHistoryState
+{
+  uint16_t eid = invalid_entity;
+  float x = 0.f;
+  float y = 0.f;
+  float ori = 0.f;
+};
+
+struct EntityHistory
+{
+  struct SavedState
+  {
+    uint32_t idx;
+    float x;
+    float y;
+    float ori;
+  };
+
+  size_t maxTicks;
+  size_t maxEntities;
+  float border;
+  // maxTicks * maxEntities, each tick sorted by eid
+  std::vector<EntityHistoryState> states;
+  std::vector<uint32_t> counts;
+  std::vector<uint32_t> ticks;
+  uint32_t newestTick = 0;
+  uint32_t numRecorded = 0;
+  // what the last rewind overwrote
+  std::vector<SavedState> saved;
+
+  // `border` > 0 makes positions wrap around a [-border, border] torus
+  EntityHistory(size_t max_ticks, size_t max_entities, float border);
+
+  // stores the world as it is at `tick`, ticks are expected to go up by one,
+  // entities beyond max_entities are not recorded
+  void record(uint32_t tick, const EntityStore &entities);
+  bool has_tick(uint32_t tick) const;
+  uint32_t oldest_tick() const;
+  const EntityHistoryState *find_state(uint32_t tick, uint16_t eid) const;
+
+  // moves every recorded entity to where it was at `tick`, fractional ticks are
+  // interpolated, entities that didn't exist back then stay where they are
+  // returns false (and touches nothing) if the tick is no longer remembered
+  bool rewind(double tick, EntityStore &entities);
+  // undoes the last rewind, the entity array must not change in between
+  void restore(EntityStore &entities);
+
+  // rewinds, calls c(), restores
+  template<typename Callable>
+  bool with_world_at(double tick, EntityStore &entities, Callable c)
+  {
+    if (!rewind(tick, entities))
+      return false;
+    c();
+    restore(entities);
+    return true;
+  }
+};
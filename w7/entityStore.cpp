@@ -0,0 +1,204 @@
+#include "entityStore.h"
+#include "mathUtils.h"
+#if !defined(__AVX2__) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define ENTITY_STORE_SSE2
+#endif
+
+EntityHandle EntityStore::push_back(const Entity &e)
+{
+  const EntityHandle h = registry.insert(e.eid);
+  if (h == invalid_handle)
+    return h;
+  x.push_back(e.x);
+  y.push_back(e.y);
+  vx.push_back(e.vx);
+  vy.push_back(e.vy);
+  ori.push_back(e.ori);
+  omega.push_back(e.omega);
+  thr.push_back(e.thr);
+  steer.push_back(e.steer);
+  color.push_back(e.color);
+  serverControlled.push_back(e.serverControlled);
+  eid.push_back(e.eid);
+  return h;
+}
+
+bool EntityStore::remove(EntityHandle h)
+{
+  const uint32_t idx = registry.erase(h);
+  if (idx == EntityRegistry::npos)
+    return false;
+  swap_remove(x, idx);
+  swap_remove(y, idx);
+  swap_remove(vx, idx);
+  swap_remove(vy, idx);
+  swap_remove(ori, idx);
+  swap_remove(omega, idx);
+  swap_remove(thr, idx);
+  swap_remove(steer, idx);
+  swap_remove(color, idx);
+  swap_remove(serverControlled, idx);
+  swap_remove(eid, idx);
+  return true;
+}
+
+Entity EntityStore::get(size_t idx) const
+{
+  Entity e;
+  e.color = color[idx];
+  e.serverControlled = serverControlled[idx] != 0;
+  e.x = x[idx];
+  e.y = y[idx];
+  e.vx = vx[idx];
+  e.vy = vy[idx];
+  e.ori = ori[idx];
+  e.omega = omega[idx];
+  e.thr = thr[idx];
+  e.steer = steer[idx];
+  e.eid = eid[idx];
+  return e;
+}
+
+void EntityStore::set(size_t idx, const Entity &e)
+{
+  color[idx] = e.color;
+  serverControlled[idx] = e.serverControlled;
+  x[idx] = e.x;
+  y[idx] = e.y;
+  vx[idx] = e.vx;
+  vy[idx] = e.vy;
+  ori[idx] = e.ori;
+  omega[idx] = e.omega;
+  thr[idx] = e.thr;
+  steer[idx] = e.steer;
+  eid[idx] = e.eid;
+}
+
+void simulate_entities_scalar(EntityStore &store, size_t first, size_t count, float dt)
+{
+  float *__restrict x = store.x.data();
+  float *__restrict y = store.y.data();
+  float *__restrict vx = store.vx.data();
+  float *__restrict vy = store.vy.data();
+  float *__restrict ori = store.ori.data();
+  float *__restrict omega = store.omega.data();
+  const float *__restrict thr = store.thr.data();
+  const float *__restrict steer = store.steer.data();
+  for (size_t i = first; i < first + count; ++i)
+  {
+    const float accel = thr[i] < 0.f ? 6.f : 1.5f;
+    const float va = clamp(thr[i], -0.3f, 1.f) * accel;
+    float sinOri, cosOri;
+    fast_sincos(ori[i], sinOri, cosOri);
+    vx[i] += cosOri * va * dt;
+    vy[i] += sinOri * va * dt;
+    omega[i] += steer[i] * dt * 0.3f;
+    ori[i] = wrap_coord(ori[i] + omega[i] * dt, PI);
+    x[i] = wrap_coord(x[i] + vx[i] * dt, worldSize);
+    y[i] = wrap_coord(y[i] + vy[i] * dt, worldSize);
+  }
+}
+
+#if defined(__AVX2__) || defined(ENTITY_STORE_SSE2)
+
+#if defined(__AVX2__)
+struct Lanes
+{
+  static constexpr size_t width = 8;
+  using V = __m256;
+  static V load(const float *p) { return _mm256_loadu_ps(p); }
+  static void store(float *p, V v) { _mm256_storeu_ps(p, v); }
+  static V set1(float f) { return _mm256_set1_ps(f); }
+  static V add(V a, V b) { return _mm256_add_ps(a, b); }
+  static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+  static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+  static V min(V a, V b) { return _mm256_min_ps(a, b); }
+  static V max(V a, V b) { return _mm256_max_ps(a, b); }
+  static V lt(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+  static V select(V mask, V a, V b) { return _mm256_blendv_ps(b, a, mask); }
+};
+#else
+struct Lanes
+{
+  static constexpr size_t width = 4;
+  using V = __m128;
+  static V load(const float *p) { return _mm_loadu_ps(p); }
+  static void store(float *p, V v) { _mm_storeu_ps(p, v); }
+  static V set1(float f) { return _mm_set1_ps(f); }
+  static V add(V a, V b) { return _mm_add_ps(a, b); }
+  static V sub(V a, V b) { return _mm_sub_ps(a, b); }
+  static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+  static V min(V a, V b) { return _mm_min_ps(a, b); }
+  static V max(V a, V b) { return _mm_max_ps(a, b); }
+  static V lt(V a, V b) { return _mm_cmplt_ps(a, b); }
+  static V select(V mask, V a, V b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+};
+#endif
+
+// same operations in the same order as the scalar path, so results match it bit for bit
+static size_t simulate_lanes(EntityStore &store, size_t first, size_t count, float dt)
+{
+  using V = Lanes::V;
+  constexpr size_t width = Lanes::width;
+  float *__restrict x = store.x.data();
+  float *__restrict y = store.y.data();
+  float *__restrict vx = store.vx.data();
+  float *__restrict vy = store.vy.data();
+  float *__restrict ori = store.ori.data();
+  float *__restrict omega = store.omega.data();
+  const float *__restrict thr = store.thr.data();
+  const float *__restrict steer = store.steer.data();
+
+  const V vdt = Lanes::set1(dt);
+  const V zero = Lanes::set1(0.f);
+  const V brakeAccel = Lanes::set1(6.f);
+  const V thrustAccel = Lanes::set1(1.5f);
+  const V minThr = Lanes::set1(-0.3f);
+  const V maxThr = Lanes::set1(1.f);
+  const V steerRate = Lanes::set1(0.3f);
+  const V pi = Lanes::set1(PI);
+  const V border = Lanes::set1(worldSize);
+
+  size_t i = first;
+  for (; i + width <= first + count; i += width)
+  {
+    V sinOri, cosOri;
+    fast_sincos(Lanes::load(ori + i), sinOri, cosOri);
+    const V t = Lanes::load(thr + i);
+    const V accel = Lanes::select(Lanes::lt(t, zero), brakeAccel, thrustAccel);
+    const V va = Lanes::mul(Lanes::min(Lanes::max(t, minThr), maxThr), accel);
+    const V nvx = Lanes::add(Lanes::load(vx + i), Lanes::mul(Lanes::mul(cosOri, va), vdt));
+    const V nvy = Lanes::add(Lanes::load(vy + i), Lanes::mul(Lanes::mul(sinOri, va), vdt));
+    const V nomega = Lanes::add(Lanes::load(omega + i), Lanes::mul(Lanes::mul(Lanes::load(steer + i), vdt), steerRate));
+    const V nori = Lanes::add(Lanes::load(ori + i), Lanes::mul(nomega, vdt));
+    const V nx = Lanes::add(Lanes::load(x + i), Lanes::mul(nvx, vdt));
+    const V ny = Lanes::add(Lanes::load(y + i), Lanes::mul(nvy, vdt));
+    Lanes::store(vx + i, nvx);
+    Lanes::store(vy + i, nvy);
+    Lanes::store(omega + i, nomega);
+    Lanes::store(ori + i, wrap_coord(nori, pi));
+    Lanes::store(x + i, wrap_coord(nx, border));
+    Lanes::store(y + i, wrap_coord(ny, border));
+  }
+  return i - first;
+}
+
+#else
+
+static size_t simulate_lanes(EntityStore &, size_t, size_t, float)
+{
+  return 0;
+}
+
+#endif
+
+void simulate_entities(EntityStore &store, size_t first, size_t count, float dt)
+{
+  const size_t done = simulate_lanes(store, first, count, dt);
+  simulate_entities_scalar(store, first + done, count - done, dt);
+}
+
+void simulate_entities(EntityStore &store, float dt)
+{
+  simulate_entities(store, 0, store.size(), dt);
+}
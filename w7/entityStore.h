@@ -0,0 +1,73 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <new>
+#include <vector>
+#include "entity.h"
+#include "entityRegistry.h"
+
+// std::vector storage aligned for the widest SIMD loads the kernels use
+template<typename T, size_t alignment = 64>
+struct AlignedAllocator
+{
+  using value_type = T;
+  template<typename U>
+  struct rebind { using other = AlignedAllocator<U, alignment>; };
+
+  AlignedAllocator() = default;
+  template<typename U>
+  AlignedAllocator(const AlignedAllocator<U, alignment> &) {}
+
+  T *allocate(size_t n) { return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(alignment))); }
+  void deallocate(T *ptr, size_t) { ::operator delete(ptr, std::align_val_t(alignment)); }
+
+  template<typename U>
+  bool operator==(const AlignedAllocator<U, alignment> &) const { return true; }
+};
+
+template<typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+// The server's world as a structure of arrays: the fields the simulation touches
+// every tick each live in their own aligned array, so a batch of entities is a
+// handful of straight vector loads. Colour, eid and the AI flag are only read
+// when something is sent and stay out of the way. `get`/`set` convert to the
+// Entity the protocol and the client work with. The registry finds an entity's
+// index by eid or handle, removal moves the last entity into the hole.
+struct EntityStore
+{
+  AlignedVector<float> x;
+  AlignedVector<float> y;
+  AlignedVector<float> vx;
+  AlignedVector<float> vy;
+  AlignedVector<float> ori;
+  AlignedVector<float> omega;
+  AlignedVector<float> thr;
+  AlignedVector<float> steer;
+
+  std::vector<uint32_t> color;
+  std::vector<uint8_t> serverControlled;
+  std::vector<uint16_t> eid;
+
+  EntityRegistry registry;
+
+  size_t size() const { return eid.size(); }
+  bool empty() const { return eid.empty(); }
+
+  // invalid_handle (and nothing added) if the eid is already in use
+  EntityHandle push_back(const Entity &e);
+  // swap-back removal, returns false for stale handles
+  bool remove(EntityHandle h);
+  // index of the entity or EntityRegistry::npos
+  uint32_t find(EntityHandle h) const { return registry.find(h); }
+  uint32_t find_eid(uint16_t id) const { return registry.find_eid(id); }
+  Entity get(size_t idx) const;
+  void set(size_t idx, const Entity &e);
+};
+
+// advances entities [first, first + count) by dt with the maths of simulate_entity,
+// AVX2 or SSE2 where the build targets it
+void simulate_entities(EntityStore &store, size_t first, size_t count, float dt);
+void simulate_entities(EntityStore &store, float dt);
+// one entity at a time, what the vector paths fall back to and are checked against
+void simulate_entities_scalar(EntityStore &store, size_t first, size_t count, float dt);
@@ -0,0 +1,124 @@
+#pragma once
+#include <cstdint>
+
+// Q16.16 fixed point for the lockstep simulation. Every operation is integer
+// arithmetic, so two machines fed the same inputs end up with the same bits no
+// matter the compiler, flags or libm. Floats only appear when converting
+// compile-time constants in and results out for drawing.
+struct Fixed
+{
+  static constexpr int fractionBits = 16;
+  static constexpr int32_t one = 1 << fractionBits;
+
+  int32_t raw = 0;
+
+  static constexpr Fixed from_raw(int32_t raw) { return Fixed{raw}; }
+  static constexpr Fixed from_int(int32_t value) { return Fixed{value * one}; }
+  // compile-time constants only, the rounding of a runtime double isn't trusted
+  static consteval Fixed from_double(double value)
+  {
+    return Fixed{int32_t(value < 0.0 ? value * one - 0.5 : value * one + 0.5)};
+  }
+  float to_float() const { return float(raw) * (1.f / one); }
+
+  constexpr Fixed operator+(Fixed rhs) const { return Fixed{raw + rhs.raw}; }
+  constexpr Fixed operator-(Fixed rhs) const { return Fixed{raw - rhs.raw}; }
+  constexpr Fixed operator-() const { return Fixed{-raw}; }
+  // C++20 guarantees the arithmetic shift
+  constexpr Fixed operator*(Fixed rhs) const { return Fixed{int32_t((int64_t(raw) * rhs.raw) >> fractionBits)}; }
+  constexpr Fixed &operator+=(Fixed rhs) { raw += rhs.raw; return *this; }
+  constexpr Fixed &operator-=(Fixed rhs) { raw -= rhs.raw; return *this; }
+
+  constexpr bool operator==(const Fixed &) const = default;
+  constexpr bool operator<(Fixed rhs) const { return raw < rhs.raw; }
+  constexpr bool operator>(Fixed rhs) const { return raw > rhs.raw; }
+  constexpr bool operator<=(Fixed rhs) const { return raw <= rhs.raw; }
+  constexpr bool operator>=(Fixed rhs) const { return raw >= rhs.raw; }
+};
+
+inline constexpr Fixed fixed_clamp(Fixed in, Fixed min, Fixed max)
+{
+  return in < min ? min : in > max ? max : in;
+}
+
+// [-border, border) with the border an exact number, so one step never leaves the range twice
+inline constexpr Fixed fixed_wrap(Fixed in, Fixed border)
+{
+  return in >= border ? in - border - border : in < -border ? in + border + border : in;
+}
+
+// Angles are binary: a full turn is 65536, wrapping is uint16_t overflow, and an
+// angular speed in turns per second is a Fixed whose raw value times dt adds
+// straight onto the angle.
+using FixedAngle = uint16_t;
+constexpr uint32_t fixedAngleTurn = 1u << 16;
+
+constexpr int fixedQuarterBits = 10;
+constexpr int fixedQuarterSize = 1 << fixedQuarterBits;
+// the low bits of a quarter turn angle interpolate between table entries
+constexpr int fixedLerpBits = 14 - fixedQuarterBits;
+
+// Taylor series with nothing but IEEE +,-,*,/ in constant evaluation, which is
+// correctly rounded everywhere, unlike a library sin()
+consteval double fixed_taylor_sin(double x)
+{
+  double term = x;
+  double sum = x;
+  for (int n = 1; n < 12; ++n)
+  {
+    term = -term * x * x / double((2 * n) * (2 * n + 1));
+    sum += term;
+  }
+  return sum;
+}
+
+struct FixedSinTable
+{
+  int32_t values[fixedQuarterSize + 1];
+};
+
+// sin over the first quarter turn, fixedQuarterSize + 1 samples including both ends
+consteval FixedSinTable make_fixed_sin_table()
+{
+  constexpr double halfPi = 1.57079632679489661923;
+  FixedSinTable table = {};
+  for (int i = 0; i <= fixedQuarterSize; ++i)
+    table.values[i] = Fixed::from_double(fixed_taylor_sin(halfPi * i / fixedQuarterSize)).raw;
+  return table;
+}
+
+inline constexpr FixedSinTable fixedSinTable = make_fixed_sin_table();
+
+// sin of an angle within the first quarter, [0, 0x4000]
+inline constexpr int32_t fixed_quarter_sin(uint32_t angle)
+{
+  const uint32_t idx = angle >> fixedLerpBits;
+  const int32_t frac = int32_t(angle & ((1u << fixedLerpBits) - 1));
+  const int32_t lo = fixedSinTable.values[idx];
+  if (frac == 0)
+    return lo;
+  return lo + (((fixedSinTable.values[idx + 1] - lo) * frac) >> fixedLerpBits);
+}
+
+inline constexpr Fixed fixed_sin(FixedAngle angle)
+{
+  const uint32_t inQuarter = angle & 0x3fffu;
+  switch (angle >> 14)
+  {
+  case 0: return Fixed::from_raw(fixed_quarter_sin(inQuarter));
+  case 1: return Fixed::from_raw(fixed_quarter_sin(0x4000u - inQuarter));
+  case 2: return Fixed::from_raw(-fixed_quarter_sin(inQuarter));
+  default: return Fixed::from_raw(-fixed_quarter_sin(0x4000u - inQuarter));
+  }
+}
+
+inline constexpr Fixed fixed_cos(FixedAngle angle)
+{
+  return fixed_sin(FixedAngle(angle + 0x4000u));
+}
+
+// [-PI, PI) radians for drawing
+inline float fixed_angle_to_radians(FixedAngle angle)
+{
+  return float(int16_t(angle)) * (3.14159265358979f / 32768.f);
+}
@@ -0,0 +1,44 @@
+#include "interestGrid.h"
+#include <algorithm>
+
+InterestGrid::InterestGrid(float border, float min_cell_size) : border(border)
+{
+  cellsPerSide = std::max(1, int(2.f * border / min_cell_size));
+  cellSize = 2.f * border / cellsPerSide;
+  cellStart.resize(cellsPerSide * cellsPerSide + 1);
+  cellCursor.resize(cellsPerSide * cellsPerSide);
+}
+
+int InterestGrid::cell_coord(float v) const
+{
+  int coord = int((v + border) / cellSize);
+  return coord < 0 ? 0 : coord >= cellsPerSide ? cellsPerSide - 1 : coord;
+}
+
+void InterestGrid::rebuild(const EntityStore &entities)
+{
+  const size_t numCells = cellCursor.size();
+  std::fill(cellStart.begin(), cellStart.end(), 0);
+  cellOf.resize(entities.size());
+  for (size_t i = 0; i < entities.size(); ++i)
+  {
+    cellOf[i] = cell_coord(entities.y[i]) * cellsPerSide + cell_coord(entities.x[i]);
+    ++cellStart[cellOf[i] + 1];
+  }
+  for (size_t cell = 0; cell < numCells; ++cell)
+  {
+    cellStart[cell + 1] += cellStart[cell];
+    cellCursor[cell] = cellStart[cell];
+  }
+
+  indices.resize(entities.size());
+  xs.resize(entities.size());
+  ys.resize(entities.size());
+  for (size_t i = 0; i < entities.size(); ++i)
+  {
+    uint32_t slot = cellCursor[cellOf[i]]++;
+    indices[slot] = i;
+    xs[slot] = entities.x[i];
+    ys[slot] = entities.y[i];
+  }
+}
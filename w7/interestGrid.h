@@ -0,0 +1,56 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "entityStore.h"
+#include "mathUtils.h"
+
+// Uniform grid over the toroidal world, rebuilt from scratch every tick with a
+// counting sort so that area of interest queries only touch nearby cells.
+struct InterestGrid
+{
+  float border = worldSize;
+  float cellSize = 1.f;
+  int cellsPerSide = 1;
+
+  std::vector<uint32_t> cellStart; // cellsPerSide^2 + 1 prefix sums
+  std::vector<uint32_t> cellCursor;
+  std::vector<uint32_t> cellOf;
+  // entity indices and positions ordered by cell
+  std::vector<uint32_t> indices;
+  std::vector<float> xs;
+  std::vector<float> ys;
+
+  InterestGrid(float border, float min_cell_size);
+
+  int cell_coord(float v) const;
+  void rebuild(const EntityStore &entities);
+
+  // calls c(entityIndex) for every entity within radius of (x, y), wrapping around the world
+  template<typename Callable>
+  void query(float x, float y, float radius, Callable c) const
+  {
+    const int reach = int(ceilf(radius / cellSize));
+    const int cx = cell_coord(x);
+    const int cy = cell_coord(y);
+    // don't visit the same cell twice when the area covers the whole world
+    const int minX = 2 * reach + 1 >= cellsPerSide ? 0 : cx - reach;
+    const int maxX = 2 * reach + 1 >= cellsPerSide ? cellsPerSide - 1 : cx + reach;
+    const int minY = 2 * reach + 1 >= cellsPerSide ? 0 : cy - reach;
+    const int maxY = 2 * reach + 1 >= cellsPerSide ? cellsPerSide - 1 : cy + reach;
+    const float radiusSq = radius * radius;
+    for (int gy = minY; gy <= maxY; ++gy)
+      for (int gx = minX; gx <= maxX; ++gx)
+      {
+        const int wx = (gx + cellsPerSide) % cellsPerSide;
+        const int wy = (gy + cellsPerSide) % cellsPerSide;
+        const int cell = wy * cellsPerSide + wx;
+        for (uint32_t i = cellStart[cell]; i < cellStart[cell + 1]; ++i)
+        {
+          const float dx = wrap_delta(xs[i] - x, border);
+          const float dy = wrap_delta(ys[i] - y, border);
+          if (dx * dx + dy * dy <= radiusSq)
+            c(indices[i]);
+        }
+      }
+  }
+};
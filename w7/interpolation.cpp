@@ -0,0 +1,107 @@
+#include "interpolation.h"
+#include "entity.h"
+#include "mathUtils.h"
+#include <algorithm>
+
+void InterpolationBuffer::push(const InterpolationSample &sample)
+{
+  if (count > 0)
+  {
+    int32_t age = int32_t(sample.time - samples[count - 1].time);
+    if (age < 0)
+      return;
+    if (age == 0)
+    {
+      samples[count - 1] = sample;
+      return;
+    }
+  }
+  if (count == interpolationBufferSize)
+  {
+    std::move(samples.begin() + 1, samples.end(), samples.begin());
+    --count;
+  }
+  samples[count++] = sample;
+}
+
+static void lerp_sample(const InterpolationSample &a, const InterpolationSample &b, float t,
+                        float &x, float &y, float &ori)
+{
+  // the world wraps around, always go the short way
+  x = wrap_delta(a.x + wrap_delta(b.x - a.x, worldSize) * t, worldSize);
+  y = wrap_delta(a.y + wrap_delta(b.y - a.y, worldSize) * t, worldSize);
+  ori = wrap_delta(a.ori + wrap_delta(b.ori - a.ori, PI) * t, PI);
+}
+
+bool InterpolationBuffer::sample(double time, double max_extrapolation, float &x, float &y,
+                                 float &ori) const
+{
+  if (count == 0)
+    return false;
+  const InterpolationSample &newest = samples[count - 1];
+  // relative to the newest sample, so that wrapping server time doesn't matter
+  const double t = time - double(newest.time);
+  if (t < 0.0 && (count == 1 || t <= double(int32_t(samples[0].time - newest.time))))
+  {
+    x = samples[0].x;
+    y = samples[0].y;
+    ori = samples[0].ori;
+    return true;
+  }
+  if (t >= 0.0)
+  {
+    // same model the server uses to decide when to send an update
+    const float dt = float(std::min(t, max_extrapolation) * 0.001);
+    x = wrap_delta(newest.x + newest.vx * dt, worldSize);
+    y = wrap_delta(newest.y + newest.vy * dt, worldSize);
+    ori = wrap_delta(newest.ori + newest.omega * dt, PI);
+    return true;
+  }
+  size_t i = count - 1;
+  while (i > 0 && double(int32_t(samples[i - 1].time - newest.time)) > t)
+    --i;
+  const InterpolationSample &a = samples[i - 1];
+  const InterpolationSample &b = samples[i];
+  const double from = double(int32_t(a.time - newest.time));
+  const double span = double(int32_t(b.time - a.time));
+  lerp_sample(a, b, float((t - from) / span), x, y, ori);
+  return true;
+}
+
+void InterpolationClock::on_snapshot(double local_time, uint32_t server_time)
+{
+  const double sampleOffset = local_time - double(server_time);
+  if (!valid)
+  {
+    offset = sampleOffset;
+    lastServerTime = server_time;
+    valid = true;
+    return;
+  }
+  constexpr double smoothing = 0.1;
+  // the fastest arrival is the closest we get to the real offset, follow it down
+  // immediately and creep up slowly in case the latency actually grew
+  const double lateness = sampleOffset - offset;
+  if (lateness < 0.0)
+    offset = sampleOffset;
+  else
+    offset += lateness * 0.01;
+  jitter += (std::max(lateness, 0.0) - jitter) * smoothing;
+  interval += (double(int32_t(server_time - lastServerTime)) - interval) * smoothing;
+  lastServerTime = server_time;
+}
+
+double InterpolationClock::target_delay() const
+{
+  // one snapshot interval to always have a pair, plus room for late arrivals
+  constexpr double margin = 5.0;
+  constexpr double maxDelay = 500.0;
+  return std::min(interval + 2.0 * jitter + margin, maxDelay);
+}
+
+double InterpolationClock::render_time(double local_time, double dt)
+{
+  const double maxStep = 0.1 * dt * 1000.0;
+  delay += std::clamp(target_delay() - delay, -maxStep, maxStep);
+  return local_time - offset - delay;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <array>
+
+// Remote entities are drawn a little in the past, between two snapshots the
+// client already has, so that late or lost packets don't show up as stutter.
+
+struct InterpolationSample
+{
+  uint32_t time = 0; // server msec
+  float x = 0.f;
+  float y = 0.f;
+  float ori = 0.f;
+  float vx = 0.f;
+  float vy = 0.f;
+  float omega = 0.f;
+};
+
+constexpr size_t interpolationBufferSize = 8;
+
+// latest server states of a single entity, oldest first
+struct InterpolationBuffer
+{
+  std::array<InterpolationSample, interpolationBufferSize> samples;
+  size_t count = 0;
+
+  // older samples are dropped, one with the same time replaces the newest
+  void push(const InterpolationSample &sample);
+  // state at `time` (server msec), coasts on the newest sample's velocity for at
+  // most `max_extrapolation` msec when the buffer runs dry, false if it is empty
+  bool sample(double time, double max_extrapolation, float &x, float &y, float &ori) const;
+};
+
+// Tracks the offset between the local and the server clock and how much the
+// snapshot arrival times jitter around it, and picks the render delay so that
+// there is almost always a newer snapshot to interpolate towards.
+struct InterpolationClock
+{
+  double offset = 0.0;   // local minus server time of the fastest arrivals, msec
+  double jitter = 0.0;   // mean lateness relative to `offset`, msec
+  double interval = 0.0; // mean time between snapshots, msec
+  double delay = 100.0;  // render delay currently in use, msec
+  uint32_t lastServerTime = 0;
+  bool valid = false;
+
+  void on_snapshot(double local_time, uint32_t server_time);
+  double target_delay() const;
+  // server time to render at, the delay eases towards its target slowly enough
+  // for the speed-up or slow-down not to be visible
+  double render_time(double local_time, double dt);
+};
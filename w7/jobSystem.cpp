@@ -0,0 +1,132 @@
+#include "jobSystem.h"
+#include <algorithm>
+
+static uint64_t pack_range(uint32_t begin, uint32_t end)
+{
+  return uint64_t(end) << 32 | begin;
+}
+
+static uint32_t range_begin(uint64_t range) { return uint32_t(range); }
+static uint32_t range_end(uint64_t range) { return uint32_t(range >> 32); }
+
+JobSystem::JobSystem(size_t num_threads)
+{
+  if (num_threads == 0)
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  ranges = std::make_unique<ChunkRange[]>(num_threads);
+  for (size_t i = 1; i < num_threads; ++i)
+    threads.emplace_back(&JobSystem::worker_main, this, i);
+}
+
+JobSystem::~JobSystem()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    quit = true;
+  }
+  wake.notify_all();
+  for (std::thread &t : threads)
+    t.join();
+}
+
+void JobSystem::parallel_for(size_t count, size_t chunk, const Job &fn)
+{
+  if (count == 0)
+    return;
+  chunk = std::max<size_t>(chunk, 1);
+  const size_t numChunks = (count + chunk - 1) / chunk;
+  if (threads.empty() || numChunks == 1)
+  {
+    for (size_t first = 0; first < count; first += chunk)
+      fn(first, std::min(chunk, count - first));
+    return;
+  }
+
+  job = &fn;
+  jobCount = count;
+  jobChunk = chunk;
+  const size_t participants = num_threads();
+  for (size_t i = 0; i < participants; ++i)
+    ranges[i].range.store(pack_range(uint32_t(numChunks * i / participants),
+                                     uint32_t(numChunks * (i + 1) / participants)), std::memory_order_relaxed);
+  busyWorkers.store(threads.size(), std::memory_order_relaxed);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    ++generation;
+  }
+  wake.notify_all();
+
+  run_chunks(0);
+  // whatever is left is being worked on, wait for the last chunk to finish
+  while (busyWorkers.load(std::memory_order_acquire) != 0)
+    std::this_thread::yield();
+  job = nullptr;
+}
+
+void JobSystem::worker_main(size_t self)
+{
+  uint64_t seen = 0;
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [&]() { return quit || generation != seen; });
+      if (quit)
+        return;
+      seen = generation;
+    }
+    run_chunks(self);
+    busyWorkers.fetch_sub(1, std::memory_order_release);
+  }
+}
+
+void JobSystem::run_chunks(size_t self)
+{
+  do
+  {
+    uint32_t chunk;
+    while (pop_chunk(self, chunk))
+    {
+      const size_t first = size_t(chunk) * jobChunk;
+      (*job)(first, std::min(jobChunk, jobCount - first));
+    }
+  } while (steal_chunks(self));
+}
+
+bool JobSystem::pop_chunk(size_t self, uint32_t &chunk)
+{
+  std::atomic<uint64_t> &own = ranges[self].range;
+  uint64_t range = own.load(std::memory_order_acquire);
+  while (range_begin(range) < range_end(range))
+  {
+    if (own.compare_exchange_weak(range, pack_range(range_begin(range) + 1, range_end(range)),
+                                  std::memory_order_acq_rel))
+    {
+      chunk = range_begin(range);
+      return true;
+    }
+  }
+  return false;
+}
+
+// takes the back half of the next thread that still has chunks left, false once all are empty
+bool JobSystem::steal_chunks(size_t self)
+{
+  const size_t participants = num_threads();
+  for (size_t attempt = 1; attempt < participants; ++attempt)
+  {
+    std::atomic<uint64_t> &victim = ranges[(self + attempt) % participants].range;
+    uint64_t range = victim.load(std::memory_order_acquire);
+    while (range_begin(range) < range_end(range))
+    {
+      const uint32_t left = range_end(range) - range_begin(range);
+      const uint32_t split = range_end(range) - (left + 1) / 2;
+      if (victim.compare_exchange_weak(range, pack_range(range_begin(range), split), std::memory_order_acq_rel))
+      {
+        ranges[self].range.store(pack_range(split, range_end(range)), std::memory_order_release);
+        return true;
+      }
+    }
+  }
+  return false;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fork/join over index ranges for the simulation. parallel_for cuts [0, count)
+// into chunks and gives every thread (the caller included) an even share. A
+// thread that runs out steals half of what is left from another one, so a
+// slow or preempted thread doesn't hold up the tick. Each thread's share is a
+// [begin, end) pair of chunk indices packed into one atomic: the owner takes
+// from the front, thieves cut from the back, both with a CAS.
+struct JobSystem
+{
+  using Job = std::function<void(size_t first, size_t count)>;
+
+  struct alignas(64) ChunkRange
+  {
+    std::atomic<uint64_t> range{0};
+  };
+
+  std::vector<std::thread> threads;
+  std::unique_ptr<ChunkRange[]> ranges; // [0] is the calling thread
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  uint64_t generation = 0;
+  bool quit = false;
+
+  // the job being run, only valid while parallel_for is
+  const Job *job = nullptr;
+  size_t jobCount = 0;
+  size_t jobChunk = 0;
+  std::atomic<size_t> busyWorkers{0};
+
+  // num_threads counts the calling thread, 0 means one per core
+  explicit JobSystem(size_t num_threads);
+  ~JobSystem();
+
+  JobSystem(const JobSystem &) = delete;
+  JobSystem &operator=(const JobSystem &) = delete;
+
+  size_t num_threads() const { return threads.size() + 1; }
+
+  // calls fn on chunks of `chunk` indices (the last one may be shorter) and
+  // returns once all of them are done, chunk starts are multiples of `chunk`
+  void parallel_for(size_t count, size_t chunk, const Job &fn);
+
+  void worker_main(size_t self);
+  void run_chunks(size_t self);
+  bool pop_chunk(size_t self, uint32_t &chunk);
+  bool steal_chunks(size_t self);
+};
@@ -0,0 +1,110 @@
+#include "journal.h"
+#include <string.h>
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static size_t padded_args_size(uint32_t args_size)
+{
+  return (size_t(args_size) + 7) & ~size_t(7);
+}
+
+JournalWriter::~JournalWriter()
+{
+  if (file)
+    fclose(file);
+}
+
+bool JournalWriter::open(const char *path, const JournalHeader &header, int argc, const char **argv)
+{
+  file = fopen(path, "wb");
+  if (!file)
+    return false;
+  JournalHeader h = header;
+  h.argsSize = 0;
+  for (int i = 0; i < argc; ++i)
+    h.argsSize += uint32_t(strlen(argv[i]) + 1);
+  fwrite(&h, sizeof(h), 1, file);
+  for (int i = 0; i < argc; ++i)
+    fwrite(argv[i], strlen(argv[i]) + 1, 1, file);
+  const uint8_t zeroes[8] = {};
+  fwrite(zeroes, padded_args_size(h.argsSize) - h.argsSize, 1, file);
+  fflush(file);
+  return true;
+}
+
+void JournalWriter::append(const JournalRecord &record)
+{
+  if (!file)
+    return;
+  fwrite(&record, sizeof(record), 1, file);
+  dirty = true;
+}
+
+void JournalWriter::flush()
+{
+  if (!dirty)
+    return;
+  fflush(file);
+  dirty = false;
+}
+
+JournalReader::~JournalReader()
+{
+#ifdef __linux__
+  if (data && buffer.empty())
+    munmap((void*)data, size);
+#endif
+}
+
+bool JournalReader::open(const char *path)
+{
+#ifdef __linux__
+  const int fd = ::open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0)
+  {
+    void *mapped = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped != MAP_FAILED)
+    {
+      data = (const uint8_t*)mapped;
+      size = size_t(st.st_size);
+    }
+  }
+  close(fd);
+#else
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    return false;
+  uint8_t chunk[65536];
+  size_t read = 0;
+  while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    buffer.insert(buffer.end(), chunk, chunk + read);
+  fclose(file);
+  data = buffer.data();
+  size = buffer.size();
+#endif
+  if (!data || size < sizeof(JournalHeader))
+    return false;
+  memcpy(&header, data, sizeof(header));
+  if (memcmp(header.magic, "MJNL", 4) != 0 || header.version != journalVersion)
+    return false;
+  const size_t recordsOffset = sizeof(JournalHeader) + padded_args_size(header.argsSize);
+  if (recordsOffset > size)
+    return false;
+  const char *arg = (const char*)data + sizeof(JournalHeader);
+  const char *argsEnd = arg + header.argsSize;
+  while (arg < argsEnd)
+  {
+    args.push_back(arg);
+    arg += strnlen(arg, size_t(argsEnd - arg)) + 1;
+  }
+  records = (const JournalRecord*)(data + recordsOffset);
+  count = (size - recordsOffset) / sizeof(JournalRecord);
+  return true;
+}
@@ -0,0 +1,398 @@
+// Headless bots to load test w7_server with, no raylib: thousands of ENet
+// connections spread over a few threads, each joins, steers its ship with random
+// or scripted input and decodes (and acks) whatever the server sends, like the
+// real client would. Once a second it prints how fast the server's clock runs,
+// how evenly snapshots or lockstep frames arrive and how much traffic that is.
+// usage: w7_loadgen [--host localhost] [--port 10131] [--clients 1000] [--threads n]
+//                   [--duration 30] [--input-rate 30] [--connect-rate 200]
+//                   [--tick-rate 60] [--scripted]
+// the server has to allow that many peers, see w7_server --max-peers
+#include <enet/enet.h>
+#include "protocol.h"
+#include "fixedTimestep.h"
+#include "rng.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct LoadgenOptions
+{
+  const char *host = "localhost";
+  uint16_t port = 10131;
+  size_t clients = 1000;
+  size_t threads = 1;
+  float duration = 30.f;
+  float inputRate = 30.f;
+  float connectRate = 200.f;
+  // the server's, snapshots only carry its clock in msec
+  float tickRate = 60.f;
+  bool scripted = false;
+};
+
+struct Bot
+{
+  ENetPeer *peer = nullptr;
+  bool connected = false;
+  uint16_t eid = invalid_entity;
+
+  // input, changed every now and then and sent at the input rate
+  uint16_t nextInputSeq = 1;
+  float thr = 0.f;
+  float steer = 0.f;
+  uint64_t nextInputNsec = 0;
+  uint64_t nextChangeNsec = 0;
+  Rng rng = Rng(0);
+
+  // world snapshots are delta compressed against what we acked
+  SnapshotHistory history;
+  bool hasSnapshot = false;
+  uint16_t lastSeq = 0;
+
+  // lockstep frames, only decoded
+  bool lockstep = false;
+
+  // the last update that moved the server clock forward
+  uint64_t lastArrivalNsec = 0;
+  double lastServerTick = 0.0;
+};
+
+// what happened since the last report, merged from every thread
+struct LoadStats
+{
+  uint64_t updates = 0; // snapshots and lockstep frames
+  double serverTicks = 0.0;
+  double wallSeconds = 0.0;
+  std::vector<float> intervalsMsec;
+  uint64_t bytesIn = 0;
+  uint64_t bytesOut = 0;
+  uint32_t badPackets = 0; // or snapshots whose baseline is gone
+
+  void merge(LoadStats &other)
+  {
+    updates += other.updates;
+    serverTicks += other.serverTicks;
+    wallSeconds += other.wallSeconds;
+    intervalsMsec.insert(intervalsMsec.end(), other.intervalsMsec.begin(), other.intervalsMsec.end());
+    bytesIn += other.bytesIn;
+    bytesOut += other.bytesOut;
+    badPackets += other.badPackets;
+    other = LoadStats();
+  }
+};
+
+struct BotThread
+{
+  ENetHost *host = nullptr;
+  std::vector<Bot> bots;
+  std::atomic<uint32_t> connected = 0;
+  std::atomic<uint32_t> joined = 0;
+
+  std::mutex mutex;
+  LoadStats stats;
+};
+
+static float get_arg(int argc, const char **argv, const char *name, float default_val)
+{
+  for (int i = 1; i + 1 < argc; ++i)
+    if (strcmp(argv[i], name) == 0)
+      return atof(argv[i + 1]);
+  return default_val;
+}
+
+static const char *get_string_arg(int argc, const char **argv, const char *name, const char *default_val)
+{
+  for (int i = 1; i + 1 < argc; ++i)
+    if (strcmp(argv[i], name) == 0)
+      return argv[i + 1];
+  return default_val;
+}
+
+static bool has_flag(int argc, const char **argv, const char *name)
+{
+  for (int i = 1; i < argc; ++i)
+    if (strcmp(argv[i], name) == 0)
+      return true;
+  return false;
+}
+
+// a snapshot or frame that moved the server's clock to `server_tick`
+static void on_update(Bot &bot, double server_tick, uint64_t now, LoadStats &stats)
+{
+  ++stats.updates;
+  if (bot.lastArrivalNsec != 0 && server_tick > bot.lastServerTick)
+  {
+    const double wall = (now - bot.lastArrivalNsec) * 1e-9;
+    stats.serverTicks += server_tick - bot.lastServerTick;
+    stats.wallSeconds += wall;
+    stats.intervalsMsec.push_back(float(wall * 1e3));
+  }
+  bot.lastArrivalNsec = now;
+  bot.lastServerTick = server_tick;
+}
+
+static void on_world_snapshot(Bot &bot, ENetPacket *packet, const LoadgenOptions &options, uint64_t now,
+                              LoadStats &stats)
+{
+  static thread_local SnapshotFrame frame;
+  if (!deserialize_world_snapshot(packet, bot.history, frame))
+  {
+    ++stats.badPackets;
+    return;
+  }
+  if (bot.hasSnapshot && uint16_t(bot.lastSeq - frame.seq) >= snapshotHistorySize &&
+      !seq_greater(frame.seq, bot.lastSeq))
+    return;
+  SnapshotFrame &stored = bot.history.push(frame.seq);
+  stored.records = frame.records;
+  send_snapshot_ack(bot.peer, frame.seq);
+  if (bot.hasSnapshot && !seq_greater(frame.seq, bot.lastSeq))
+    return;
+  bot.hasSnapshot = true;
+  bot.lastSeq = frame.seq;
+  on_update(bot, frame.serverTime * options.tickRate * 1e-3, now, stats);
+}
+
+static void on_lockstep_frame(Bot &bot, ENetPacket *packet, uint64_t now, LoadStats &stats)
+{
+  static thread_local LockstepFrame frame;
+  if (!deserialize_lockstep_frame(packet, frame))
+  {
+    ++stats.badPackets;
+    return;
+  }
+  on_update(bot, frame.tick, now, stats);
+}
+
+static void on_receive(BotThread &thread, Bot &bot, ENetPacket *packet, const LoadgenOptions &options,
+                       uint64_t now, LoadStats &stats)
+{
+  switch (get_packet_type(packet))
+  {
+  case E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY:
+    deserialize_set_controlled_entity(packet, bot.eid);
+    ++thread.joined;
+    break;
+  case E_SERVER_TO_CLIENT_WORLD_SNAPSHOT:
+    on_world_snapshot(bot, packet, options, now, stats);
+    break;
+  case E_SERVER_TO_CLIENT_LOCKSTEP_STATE:
+    bot.lockstep = true;
+    break;
+  case E_SERVER_TO_CLIENT_LOCKSTEP_FRAME:
+    on_lockstep_frame(bot, packet, now, stats);
+    break;
+  default:
+    break;
+  };
+}
+
+static void update_input(Bot &bot, size_t bot_idx, const LoadgenOptions &options, uint64_t now)
+{
+  if (options.scripted)
+  {
+    // full throttle, turning one way, then the other, then straight, 2 s each
+    bot.thr = 1.f;
+    bot.steer = float(int((now / 2000000000ull + bot_idx) % 3) - 1);
+    return;
+  }
+  if (now < bot.nextChangeNsec)
+    return;
+  bot.thr = float(int(bot.rng.below(3)) - 1);
+  bot.steer = float(int(bot.rng.below(3)) - 1);
+  bot.nextChangeNsec = now + (500 + bot.rng.below(1500)) * 1000000ull;
+}
+
+static void run_bots(BotThread &thread, size_t first_bot, const LoadgenOptions &options, ENetAddress address,
+                     const std::atomic<bool> &quit)
+{
+  const uint64_t startNsec = get_time_nsec();
+  const uint64_t inputNsec = uint64_t(1e9 / options.inputRate);
+  // this thread's share of the connect rate
+  const double connectsPerNsec = options.connectRate / options.threads * 1e-9;
+  size_t numStarted = 0;
+  LoadStats stats;
+  while (!quit)
+  {
+    uint64_t now = get_time_nsec();
+    // ramp up, a burst of thousands of handshakes is a different test
+    const size_t due = std::min(thread.bots.size(), size_t((now - startNsec) * connectsPerNsec) + 1);
+    for (; numStarted < due; ++numStarted)
+    {
+      Bot &bot = thread.bots[numStarted];
+      bot.rng = Rng(first_bot + numStarted);
+      bot.peer = enet_host_connect(thread.host, &address, 2, 0);
+      if (bot.peer)
+        bot.peer->data = &bot;
+    }
+
+    ENetEvent event;
+    while (enet_host_service(thread.host, &event, 1) > 0)
+    {
+      now = get_time_nsec();
+      Bot *bot = (Bot*)event.peer->data;
+      switch (event.type)
+      {
+      case ENET_EVENT_TYPE_CONNECT:
+        bot->connected = true;
+        ++thread.connected;
+        send_join(event.peer);
+        break;
+      case ENET_EVENT_TYPE_DISCONNECT:
+        if (bot->connected)
+          --thread.connected;
+        if (bot->eid != invalid_entity)
+          --thread.joined;
+        bot->connected = false;
+        bot->eid = invalid_entity;
+        bot->peer = nullptr;
+        break;
+      case ENET_EVENT_TYPE_RECEIVE:
+        on_receive(thread, *bot, event.packet, options, now, stats);
+        enet_packet_destroy(event.packet);
+        break;
+      default:
+        break;
+      };
+    }
+
+    now = get_time_nsec();
+    for (size_t i = 0; i < numStarted; ++i)
+    {
+      Bot &bot = thread.bots[i];
+      if (bot.eid == invalid_entity || now < bot.nextInputNsec)
+        continue;
+      update_input(bot, first_bot + i, options, now);
+      send_entity_input(bot.peer, bot.eid, bot.nextInputSeq++, bot.thr, bot.steer);
+      // spread out so the bots don't all send on the same millisecond
+      bot.nextInputNsec = bot.nextInputNsec == 0 ? now + bot.rng.below(uint32_t(inputNsec)) : now + inputNsec;
+    }
+
+    stats.bytesIn += thread.host->totalReceivedData;
+    stats.bytesOut += thread.host->totalSentData;
+    thread.host->totalReceivedData = 0;
+    thread.host->totalSentData = 0;
+    std::lock_guard<std::mutex> lock(thread.mutex);
+    thread.stats.merge(stats);
+  }
+
+  for (Bot &bot : thread.bots)
+    if (bot.peer)
+      enet_peer_disconnect(bot.peer, 0);
+  enet_host_flush(thread.host);
+}
+
+static void print_stats(const char *label, LoadStats &stats, double seconds, uint32_t connected, uint32_t joined,
+                        size_t clients)
+{
+  std::vector<float> &intervals = stats.intervalsMsec;
+  double mean = 0.0;
+  double var = 0.0;
+  for (float i : intervals)
+    mean += i;
+  mean = intervals.empty() ? 0.0 : mean / intervals.size();
+  for (float i : intervals)
+    var += (i - mean) * (i - mean);
+  const double jitter = intervals.empty() ? 0.0 : sqrt(var / intervals.size());
+  std::sort(intervals.begin(), intervals.end());
+  const float p99 = intervals.empty() ? 0.f : intervals[std::min(intervals.size() - 1, size_t(intervals.size() * 0.99))];
+  const float maxInterval = intervals.empty() ? 0.f : intervals.back();
+  printf("%s: %u/%u/%zu connected/joined/bots, server %.1f ticks/s, %.1f updates/s per bot, "
+         "interval %.1f ms jitter %.2f ms p99 %.1f ms max %.1f ms, in %.1f kB/s out %.1f kB/s, %u bad packets\n",
+         label, connected, joined, clients, stats.wallSeconds > 0.0 ? stats.serverTicks / stats.wallSeconds : 0.0,
+         joined ? stats.updates / seconds / joined : 0.0, mean, jitter, p99, maxInterval,
+         stats.bytesIn / seconds / 1024.0, stats.bytesOut / seconds / 1024.0, stats.badPackets);
+}
+
+int main(int argc, const char **argv)
+{
+  LoadgenOptions options;
+  options.host = get_string_arg(argc, argv, "--host", options.host);
+  options.port = uint16_t(get_arg(argc, argv, "--port", options.port));
+  options.clients = std::max(1, int(get_arg(argc, argv, "--clients", float(options.clients))));
+  options.threads = std::max(1, int(get_arg(argc, argv, "--threads", float(std::thread::hardware_concurrency()))));
+  options.threads = std::min(options.threads, options.clients);
+  options.duration = get_arg(argc, argv, "--duration", options.duration);
+  options.inputRate = std::max(1.f, get_arg(argc, argv, "--input-rate", options.inputRate));
+  options.connectRate = std::max(1.f, get_arg(argc, argv, "--connect-rate", options.connectRate));
+  options.tickRate = get_arg(argc, argv, "--tick-rate", options.tickRate);
+  options.scripted = has_flag(argc, argv, "--scripted");
+
+  if (enet_initialize() != 0)
+  {
+    printf("Cannot init ENet");
+    return 1;
+  }
+  ENetAddress address;
+  enet_address_set_host(&address, options.host);
+  address.port = options.port;
+
+  // a host holds at most ENET_PROTOCOL_MAXIMUM_PEER_ID peers, every thread has its own
+  std::vector<BotThread> threads(options.threads);
+  size_t firstBot = 0;
+  std::vector<size_t> firstBots;
+  for (size_t i = 0; i < threads.size(); ++i)
+  {
+    const size_t count = options.clients / threads.size() + (i < options.clients % threads.size() ? 1 : 0);
+    threads[i].bots.resize(count);
+    threads[i].host = enet_host_create(nullptr, count, 2, 0, 0);
+    if (!threads[i].host)
+    {
+      printf("Cannot create ENet client host for %zu bots\n", count);
+      return 1;
+    }
+    firstBots.push_back(firstBot);
+    firstBot += count;
+  }
+
+  std::atomic<bool> quit = false;
+  std::vector<std::thread> workers;
+  for (size_t i = 0; i < threads.size(); ++i)
+    workers.emplace_back(run_bots, std::ref(threads[i]), firstBots[i], std::cref(options), address, std::cref(quit));
+
+  LoadStats total;
+  const uint64_t startNsec = get_time_nsec();
+  uint64_t lastReportNsec = startNsec;
+  while (get_time_nsec() - startNsec < uint64_t(options.duration * 1e9))
+  {
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    const uint64_t now = get_time_nsec();
+    LoadStats second;
+    uint32_t connected = 0;
+    uint32_t joined = 0;
+    for (BotThread &thread : threads)
+    {
+      std::lock_guard<std::mutex> lock(thread.mutex);
+      second.merge(thread.stats);
+      connected += thread.connected;
+      joined += thread.joined;
+    }
+    char label[32];
+    snprintf(label, sizeof(label), "%5.1f s", (now - startNsec) * 1e-9);
+    LoadStats report = second;
+    print_stats(label, report, (now - lastReportNsec) * 1e-9, connected, joined, options.clients);
+    total.merge(second);
+    lastReportNsec = now;
+  }
+  quit = true;
+  for (std::thread &worker : workers)
+    worker.join();
+
+  uint32_t connected = 0;
+  uint32_t joined = 0;
+  for (BotThread &thread : threads)
+  {
+    connected += thread.connected;
+    joined += thread.joined;
+  }
+  print_stats("total", total, (get_time_nsec() - startNsec) * 1e-9, connected, joined, options.clients);
+  for (BotThread &thread : threads)
+    enet_host_destroy(thread.host);
+  atexit(enet_deinitialize);
+  return 0;
+}
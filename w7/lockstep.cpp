@@ -0,0 +1,161 @@
+#include "lockstep.h"
+#include "mathUtils.h"
+#include "rng.h"
+
+constexpr Fixed brakeAccel = Fixed::from_double(6.0);
+constexpr Fixed thrustAccel = Fixed::from_double(1.5);
+constexpr Fixed minThr = Fixed::from_double(-0.3);
+constexpr Fixed maxThr = Fixed::from_double(1.0);
+// simulate_entity's 0.3 rad/s^2, in turns
+constexpr Fixed steerRate = Fixed::from_double(0.3 / 6.28318530717958647692);
+constexpr Fixed border = Fixed::from_double(worldSize);
+
+void LockstepFrame::clear()
+{
+  tick = 0;
+  spawns.clear();
+  despawns.clear();
+  inputs.clear();
+  hasChecksum = false;
+  checksum = 0;
+}
+
+void LockstepWorld::reset(uint64_t world_seed, uint32_t cur_tick, Fixed tick_dt)
+{
+  seed = world_seed;
+  tick = cur_tick;
+  dt = tick_dt;
+  entities.clear();
+  registry = EntityRegistry();
+}
+
+bool LockstepWorld::spawn(const LockstepEntity &e)
+{
+  if (registry.insert(e.eid) == invalid_handle)
+    return false;
+  entities.push_back(e);
+  return true;
+}
+
+void LockstepWorld::despawn(uint16_t eid)
+{
+  const uint32_t idx = registry.find_eid(eid);
+  if (idx == EntityRegistry::npos)
+    return;
+  registry.erase(registry.handle_at(idx));
+  swap_remove(entities, idx);
+}
+
+void LockstepWorld::step(const LockstepFrame &frame)
+{
+  for (const LockstepEntity &e : frame.spawns)
+    spawn(e);
+  for (uint16_t eid : frame.despawns)
+    despawn(eid);
+  for (const LockstepInput &input : frame.inputs)
+  {
+    const uint32_t idx = registry.find_eid(input.eid);
+    if (idx == EntityRegistry::npos)
+      continue;
+    entities[idx].thr = input.thr;
+    entities[idx].steer = input.steer;
+  }
+  tick = frame.tick;
+  for (LockstepEntity &e : entities)
+  {
+    if (e.serverControlled)
+      update_lockstep_ai(e, seed, tick);
+    simulate_lockstep_entity(e, dt);
+  }
+}
+
+uint64_t LockstepWorld::checksum() const
+{
+  // a sum of per-entity hashes, so removal order doesn't matter
+  uint64_t sum = mix64(tick);
+  for (const LockstepEntity &e : entities)
+  {
+    uint64_t h = mix64(uint64_t(e.eid) << 32 | e.color);
+    h = mix64(h ^ (uint64_t(uint32_t(e.x.raw)) << 32 | uint32_t(e.y.raw)));
+    h = mix64(h ^ (uint64_t(uint32_t(e.vx.raw)) << 32 | uint32_t(e.vy.raw)));
+    h = mix64(h ^ (uint64_t(uint32_t(e.omega.raw)) << 32 | uint32_t(e.ori) << 16 |
+                   uint32_t(uint8_t(e.thr)) << 8 | uint8_t(e.steer)));
+    sum += h;
+  }
+  return sum;
+}
+
+Entity LockstepWorld::get(size_t idx) const
+{
+  const LockstepEntity &le = entities[idx];
+  Entity e;
+  e.color = le.color;
+  e.serverControlled = le.serverControlled;
+  e.x = le.x.to_float();
+  e.y = le.y.to_float();
+  e.vx = le.vx.to_float();
+  e.vy = le.vy.to_float();
+  e.ori = fixed_angle_to_radians(le.ori);
+  e.omega = le.omega.to_float() * 2.f * PI;
+  e.thr = le.thr;
+  e.steer = le.steer;
+  e.eid = le.eid;
+  return e;
+}
+
+// simulate_entity in fixed point
+void simulate_lockstep_entity(LockstepEntity &e, Fixed dt)
+{
+  const Fixed accel = e.thr < 0 ? brakeAccel : thrustAccel;
+  const Fixed va = fixed_clamp(Fixed::from_int(e.thr), minThr, maxThr) * accel;
+  e.vx += fixed_cos(e.ori) * va * dt;
+  e.vy += fixed_sin(e.ori) * va * dt;
+  e.omega += Fixed::from_int(e.steer) * dt * steerRate;
+  e.ori = FixedAngle(e.ori + (e.omega * dt).raw);
+  e.x = fixed_wrap(e.x + e.vx * dt, border);
+  e.y = fixed_wrap(e.y + e.vy * dt, border);
+}
+
+// the same decisions update_ai makes, from the same stream
+void update_lockstep_ai(LockstepEntity &e, uint64_t seed, uint32_t tick)
+{
+  const uint64_t r = rng_at(seed, e.eid, tick);
+  // small random chance to enable or disable throttle
+  if ((r & 0xffff) % 100 == 0)
+    e.thr = e.thr > 0 ? 0 : 1;
+  // small random chance to enable or disable steering
+  if ((r >> 16 & 0xffff) % 10 == 0)
+    e.steer = e.steer != 0 ? 0 : int8_t((r >> 32 & 1) * 2 - 1);
+}
+
+static Fixed to_fixed(float value)
+{
+  return Fixed::from_raw(int32_t(value * Fixed::one + (value < 0.f ? -0.5f : 0.5f)));
+}
+
+LockstepEntity to_lockstep_entity(const Entity &e)
+{
+  LockstepEntity le;
+  le.color = e.color;
+  le.serverControlled = e.serverControlled;
+  le.x = to_fixed(e.x);
+  le.y = to_fixed(e.y);
+  le.vx = to_fixed(e.vx);
+  le.vy = to_fixed(e.vy);
+  le.ori = FixedAngle(int32_t(e.ori * (float(fixedAngleTurn) / (2.f * PI))));
+  le.omega = to_fixed(e.omega / (2.f * PI));
+  le.thr = to_lockstep_axis(e.thr);
+  le.steer = to_lockstep_axis(e.steer);
+  le.eid = e.eid;
+  return le;
+}
+
+int8_t to_lockstep_axis(float value)
+{
+  return value > 0.5f ? 1 : value < -0.5f ? -1 : 0;
+}
+
+Fixed lockstep_dt(uint32_t tick_rate)
+{
+  return Fixed::from_raw(int32_t((uint32_t(Fixed::one) + tick_rate / 2) / tick_rate));
+}
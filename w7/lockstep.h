@@ -0,0 +1,89 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "entity.h"
+#include "entityRegistry.h"
+#include "fixedPoint.h"
+
+// Deterministic lockstep: the server and every client run the same fixed point
+// simulation, and only the per-tick input frames go over the wire. The AI is
+// driven by the seeded RNG, so 100 AI ships cost nothing to replicate, traffic
+// grows with the number of players, not ships. Every so often a frame carries
+// the server's checksum so clients notice a desync and ask for the full state.
+
+// how often, in ticks, a frame carries the server's checksum
+constexpr uint32_t lockstepChecksumInterval = 30;
+
+struct LockstepEntity
+{
+  // immutable state
+  uint32_t color = 0xff00ffff;
+  bool serverControlled = false;
+
+  // mutable state
+  Fixed x;
+  Fixed y;
+  Fixed vx;
+  Fixed vy;
+  FixedAngle ori = 0;
+  Fixed omega; // turns per second
+
+  // user input, keys are either pressed or not
+  int8_t thr = 0;
+  int8_t steer = 0;
+
+  uint16_t eid = invalid_entity;
+};
+
+struct LockstepInput
+{
+  uint16_t eid = invalid_entity;
+  int8_t thr = 0;
+  int8_t steer = 0;
+};
+
+// Everything that happens at the start of a tick, applied in this order, then
+// the tick is simulated. Inputs are only sent when a ship's controls change.
+struct LockstepFrame
+{
+  uint32_t tick = 0;
+  std::vector<LockstepEntity> spawns;
+  std::vector<uint16_t> despawns;
+  std::vector<LockstepInput> inputs;
+  // of the world after the tick
+  bool hasChecksum = false;
+  uint64_t checksum = 0;
+
+  void clear();
+};
+
+struct LockstepWorld
+{
+  uint64_t seed = 0;
+  // the last tick simulated
+  uint32_t tick = 0;
+  Fixed dt;
+  std::vector<LockstepEntity> entities;
+  EntityRegistry registry; // eid -> index into `entities`
+
+  void reset(uint64_t world_seed, uint32_t cur_tick, Fixed tick_dt);
+  // false if the eid is taken
+  bool spawn(const LockstepEntity &e);
+  void despawn(uint16_t eid);
+  // applies `frame` and simulates its tick, which has to be the next one
+  void step(const LockstepFrame &frame);
+  // doesn't depend on the order of `entities`
+  uint64_t checksum() const;
+  Entity get(size_t idx) const;
+};
+
+void simulate_lockstep_entity(LockstepEntity &e, Fixed dt);
+void update_lockstep_ai(LockstepEntity &e, uint64_t seed, uint32_t tick);
+
+// the one place floats turn into lockstep state, only the side that owns the
+// value converts, everyone else gets the raw bits
+LockstepEntity to_lockstep_entity(const Entity &e);
+int8_t to_lockstep_axis(float value);
+// the fixed tick length, sent to clients with the state
+Fixed lockstep_dt(uint32_t tick_rate);
@@ -1,17 +1,26 @@
 // initial skeleton is a clone from https://github.com/jpcy/bgfx-minimal-example
 //
 #include <functional>
+// before raylib, which defines PI as a macro
+#include "mathUtils.h"
 #include "raylib.h"
 #include <enet/enet.h>
 #include <math.h>
 
 #include <vector>
+#include <array>
+#include <algorithm>
 #include "entity.h"
 #include "protocol.h"
+#include "interpolation.h"
+#include "entityRegistry.h"
+#include "fixedTimestep.h"
+#include <stdlib.h>
+#include <string.h>
 
 
 static std::vector<Entity> entities;
-static std::unordered_map<uint16_t, size_t> indexMap;
+static EntityRegistry registry; // eid -> index into `entities`
 static uint16_t my_entity = invalid_entity;
 
 struct BandwidthAccumulator
@@ -28,15 +37,90 @@ uint32_t get_delta_data(const std::vector<std::pair<uint32_t, float>>& data)
   return data.back().first - data.front().first;
 }
 
+// remote entities are drawn from here, runs parallel to `entities`
+static std::vector<InterpolationBuffer> interpolation;
+static InterpolationClock interpolationClock;
+// how long a ship keeps coasting when its snapshots stop coming, msec, the
+// server refreshes every entity well within this
+constexpr double maxExtrapolation = deadReckoningMaxAge + 250.0;
+
+static double get_local_time_msec()
+{
+  return GetTime() * 1000.0;
+}
+
+static SnapshotHistory snapshotHistory;
+static bool hasAppliedSnapshot = false;
+static uint16_t lastAppliedSeq = 0;
+
+// client-side prediction, every input is kept until the server confirms it
+struct InputRecord
+{
+  uint16_t seq = 0;
+  float thr = 0.f;
+  float steer = 0.f;
+};
+constexpr size_t inputHistorySize = 256; // ~4 seconds at 60 ticks per second
+static std::array<InputRecord, inputHistorySize> inputHistory;
+static uint16_t nextInputSeq = 1;
+// our ship is predicted in steps of the server's tick with one input each, so the
+// sequence number counts steps and reconcile replays exactly what the server runs
+static FixedTimestep predictionStep(60.f);
+
+// corrections are not applied to the picture at once, the offset fades out instead
+struct PredictionError
+{
+  float x = 0.f;
+  float y = 0.f;
+  float ori = 0.f;
+};
+static PredictionError predictionError;
+
+// lockstep mode, the server sent us its world and we simulate it from its
+// frames, `entities` is just a copy for drawing
+static bool lockstepMode = false;
+static LockstepWorld lockstepWorld;
+// frames are skipped until the state we asked for arrives
+static bool lockstepResyncing = false;
+
 void on_new_entity_packet(ENetPacket *packet)
 {
   Entity newEntity;
   deserialize_new_entity(packet, newEntity);
-  auto itf = indexMap.find(newEntity.eid);
-  if (itf != indexMap.end())
+  if (registry.find_eid(newEntity.eid) != EntityRegistry::npos)
     return; // don't need to do anything, we already have entity
-  indexMap[newEntity.eid] = entities.size();
+  uint32_t sampleTime = interpolationClock.lastServerTime;
+  // snapshots may have overtaken the reliable spawn, don't lose their update
+  if (const SnapshotFrame *frame = hasAppliedSnapshot ? snapshotHistory.find(lastAppliedSeq) : nullptr)
+  {
+    auto rec = std::lower_bound(frame->records.begin(), frame->records.end(), newEntity.eid,
+                                [](const EntityRecord &r, uint16_t eid) { return r.eid < eid; });
+    if (rec != frame->records.end() && rec->eid == newEntity.eid)
+    {
+      unpack_entity_record(*rec, newEntity.x, newEntity.y, newEntity.ori);
+      unpack_entity_velocity(*rec, newEntity.vx, newEntity.vy, newEntity.omega);
+      sampleTime = rec->time;
+    }
+  }
+  registry.insert(newEntity.eid);
   entities.push_back(newEntity);
+  interpolation.emplace_back();
+  if (hasAppliedSnapshot)
+    interpolation.back().push({sampleTime, newEntity.x, newEntity.y, newEntity.ori,
+                               newEntity.vx, newEntity.vy, newEntity.omega});
+}
+
+void on_remove_entity(ENetPacket *packet)
+{
+  uint16_t eid = invalid_entity;
+  deserialize_remove_entity(packet, eid);
+  const uint32_t idx = registry.find_eid(eid);
+  if (idx == EntityRegistry::npos)
+    return;
+  // swap with the last one to keep the array dense
+  registry.erase(registry.handle_at(idx));
+  swap_remove(entities, idx);
+  swap_remove(interpolation, idx);
 }
 
 void on_set_controlled_entity(ENetPacket *packet)
@@ -47,9 +131,9 @@ void on_set_controlled_entity(ENetPacket *packet)
 template<typename Callable>
 static void get_entity(uint16_t eid, Callable c)
 {
-  auto itf = indexMap.find(eid);
-  if (itf != indexMap.end())
-    c(entities[itf->second]);
+  const uint32_t idx = registry.find_eid(eid);
+  if (idx != EntityRegistry::npos)
+    c(entities[idx]);
 }
 
 void on_snapshot(ENetPacket *packet)
@@ -65,6 +149,116 @@ void on_snapshot(ENetPacket *packet)
   });
 }
 
+// rewinds our ship to the server state and replays what the server hasn't seen yet
+static void reconcile(const ControlledState &auth)
+{
+  get_entity(my_entity, [&](Entity& e)
+  {
+    const Entity predicted = e;
+    e.x = auth.x;
+    e.y = auth.y;
+    e.vx = auth.vx;
+    e.vy = auth.vy;
+    e.ori = auth.ori;
+    e.omega = auth.omega;
+    size_t numPending = std::min<size_t>(uint16_t(nextInputSeq - auth.inputSeq - 1), inputHistorySize);
+    for (uint16_t seq = nextInputSeq - numPending; seq != nextInputSeq; ++seq)
+    {
+      const InputRecord &input = inputHistory[seq % inputHistorySize];
+      if (input.seq != seq)
+        continue;
+      e.thr = input.thr;
+      e.steer = input.steer;
+      simulate_entity(e, predictionStep.dt());
+    }
+    predictionError.x += wrap_delta(predicted.x - e.x, worldSize);
+    predictionError.y += wrap_delta(predicted.y - e.y, worldSize);
+    predictionError.ori += wrap_delta(predicted.ori - e.ori, PI);
+  });
+}
+
+void on_world_snapshot(ENetPacket *packet, ENetPeer *peer)
+{
+  static SnapshotFrame frame;
+  if (!deserialize_world_snapshot(packet, snapshotHistory, frame))
+    return; // baseline is gone, server falls back to an older ack or a full snapshot
+  if (hasAppliedSnapshot && uint16_t(lastAppliedSeq - frame.seq) >= snapshotHistorySize &&
+      !seq_greater(frame.seq, lastAppliedSeq))
+    return; // too old to even serve as a baseline
+  SnapshotFrame &stored = snapshotHistory.push(frame.seq);
+  stored.records = frame.records;
+  send_snapshot_ack(peer, frame.seq);
+
+  // unsequenced, so late frames are kept as baselines but never applied
+  if (hasAppliedSnapshot && !seq_greater(frame.seq, lastAppliedSeq))
+    return;
+  hasAppliedSnapshot = true;
+  lastAppliedSeq = frame.seq;
+  interpolationClock.on_snapshot(get_local_time_msec(), frame.serverTime);
+  for (const EntityRecord &rec : frame.records)
+  {
+    const uint32_t idx = registry.find_eid(rec.eid);
+    if (idx == EntityRegistry::npos)
+      continue;
+    // entities the server didn't update come back with their old state and
+    // time, that is not a new sample and extrapolation does better
+    InterpolationBuffer &buffer = interpolation[idx];
+    if (buffer.count > 0 && buffer.samples[buffer.count - 1].time == rec.time)
+      continue;
+    InterpolationSample sample = {rec.time};
+    unpack_entity_record(rec, sample.x, sample.y, sample.ori);
+    unpack_entity_velocity(rec, sample.vx, sample.vy, sample.omega);
+    buffer.push(sample);
+  }
+  if (frame.hasControlled)
+    reconcile(frame.controlled);
+}
+
+static void on_lockstep_state(ENetPacket *packet, ENetPeer *peer)
+{
+  lockstepResyncing = false;
+  if (!deserialize_lockstep_state(packet, lockstepWorld))
+  {
+    lockstepResyncing = true;
+    send_lockstep_resync(peer);
+    return;
+  }
+  lockstepMode = true;
+}
+
+static void on_lockstep_frame(ENetPacket *packet, ENetPeer *peer)
+{
+  static LockstepFrame frame;
+  if (!lockstepMode || lockstepResyncing)
+    return;
+  const bool valid = deserialize_lockstep_frame(packet, frame);
+  // frames from before the state we got
+  if (valid && int32_t(frame.tick - lockstepWorld.tick) <= 0)
+    return;
+  if (valid && frame.tick == lockstepWorld.tick + 1)
+  {
+    lockstepWorld.step(frame);
+    if (!frame.hasChecksum || frame.checksum == lockstepWorld.checksum())
+      return;
+    printf("Lockstep desync at tick %u\n", frame.tick);
+  }
+  lockstepResyncing = true;
+  send_lockstep_resync(peer);
+}
+
+// drawing and the camera keep working on `entities`
+static void copy_lockstep_world()
+{
+  entities.clear();
+  registry = EntityRegistry();
+  for (size_t i = 0; i < lockstepWorld.entities.size(); ++i)
+  {
+    registry.insert(lockstepWorld.entities[i].eid);
+    entities.push_back(lockstepWorld.get(i));
+  }
+  interpolation.resize(entities.size());
+}
+
 static void on_time(ENetPacket *packet, ENetPeer* peer)
 {
   uint32_t timeMsec;
@@ -72,6 +266,19 @@ static void on_time(ENetPacket *packet, ENetPeer* peer)
   enet_time_set(timeMsec + peer->lastRoundTripTime / 2);
 }
 
+static void interpolate_entities(float dt)
+{
+  if (!interpolationClock.valid)
+    return;
+  const double renderTime = interpolationClock.render_time(get_local_time_msec(), dt);
+  for (size_t i = 0; i < entities.size(); ++i)
+  {
+    Entity &e = entities[i];
+    if (e.eid != my_entity)
+      interpolation[i].sample(renderTime, maxExtrapolation, e.x, e.y, e.ori);
+  }
+}
+
 static void draw_ship(float shipLen, float shipWidth, float x, float y, const Vector2& fwd, const Vector2& left, Color col)
 {
   DrawTriangle(Vector2{x + fwd.x * shipLen * 0.5f, y + fwd.y * shipLen * 0.5f},
@@ -80,8 +287,14 @@ static void draw_ship(float shipLen, float shipWidth, float x, float y, const Ve
                col);
 }
 
-static void draw_entity(const Entity& e)
+static void draw_entity(Entity e)
 {
+  if (e.eid == my_entity)
+  {
+    e.x += predictionError.x;
+    e.y += predictionError.y;
+    e.ori += predictionError.ori;
+  }
   const float shipLen = 3.f;
   const float shipWidth = 2.f;
   const Vector2 fwd = Vector2{cosf(e.ori), sinf(e.ori)};
@@ -108,15 +321,29 @@ static void update_net(ENetHost* client, ENetPeer* serverPeer)
       case E_SERVER_TO_CLIENT_NEW_ENTITY:
         on_new_entity_packet(event.packet);
         break;
+      case E_SERVER_TO_CLIENT_REMOVE_ENTITY:
+        on_remove_entity(event.packet);
+        break;
       case E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY:
         on_set_controlled_entity(event.packet);
         break;
       case E_SERVER_TO_CLIENT_SNAPSHOT:
         on_snapshot(event.packet);
         break;
+      case E_SERVER_TO_CLIENT_WORLD_SNAPSHOT:
+        on_world_snapshot(event.packet, event.peer);
+        break;
       case E_SERVER_TO_CLIENT_TIME_MSEC:
         on_time(event.packet, event.peer);
         break;
+      case E_SERVER_TO_CLIENT_LOCKSTEP_STATE:
+        on_lockstep_state(event.packet, event.peer);
+        break;
+      case E_SERVER_TO_CLIENT_LOCKSTEP_FRAME:
+        on_lockstep_frame(event.packet, event.peer);
+        break;
+      default:
+        break; // client to server messages, a server never sends them
       };
       enet_packet_destroy(event.packet);
       break;
@@ -126,23 +353,47 @@ static void update_net(ENetHost* client, ENetPeer* serverPeer)
   }
 }
 
-static void simulate_world(ENetPeer* serverPeer)
+// one fixed step of our ship, the input goes out and into the history
+static void predict_step(ENetPeer* serverPeer)
 {
-  if (my_entity != invalid_entity)
+  bool left = IsKeyDown(KEY_LEFT);
+  bool right = IsKeyDown(KEY_RIGHT);
+  bool up = IsKeyDown(KEY_UP);
+  bool down = IsKeyDown(KEY_DOWN);
+  get_entity(my_entity, [&](Entity& e)
   {
-    bool left = IsKeyDown(KEY_LEFT);
-    bool right = IsKeyDown(KEY_RIGHT);
-    bool up = IsKeyDown(KEY_UP);
-    bool down = IsKeyDown(KEY_DOWN);
-    get_entity(my_entity, [&](Entity& e)
-    {
-        // Update
-        float thr = (up ? 1.f : 0.f) + (down ? -1.f : 0.f);
-        float steer = (left ? -1.f : 0.f) + (right ? 1.f : 0.f);
+      // Update
+      float thr = (up ? 1.f : 0.f) + (down ? -1.f : 0.f);
+      float steer = (left ? -1.f : 0.f) + (right ? 1.f : 0.f);
+
+      // Send
+      inputHistory[nextInputSeq % inputHistorySize] = {nextInputSeq, thr, steer};
+      send_entity_input(serverPeer, my_entity, nextInputSeq++, thr, steer);
+
+      // the input only takes effect with the frame it comes back in
+      if (lockstepMode)
+        return;
+
+      // Predict, the server will run the same simulation once the input arrives
+      e.thr = thr;
+      e.steer = steer;
+      simulate_entity(e, predictionStep.dt());
+  });
+}
 
-        // Send
-        send_entity_input(serverPeer, my_entity, thr, steer);
-    });
+static void simulate_world(ENetPeer* serverPeer, float dt)
+{
+  // a tenth of the error is left after a quarter of a second
+  const float errorDecay = powf(0.1f, dt / 0.25f);
+  predictionError.x *= errorDecay;
+  predictionError.y *= errorDecay;
+  predictionError.ori *= errorDecay;
+  const uint32_t due = predictionStep.advance();
+  for (uint32_t i = 0; i < due; ++i)
+  {
+    if (my_entity != invalid_entity)
+      predict_step(serverPeer);
+    predictionStep.end_tick(0);
   }
 }
 
@@ -200,6 +451,15 @@ void update_bandwidth(float dt, ENetHost* host, BandwidthAccumulator& accum)
   eraseOld(accum.outData);
 }
 
+static float get_arg(int argc, const char **argv, const char *name, float default_val)
+{
+  for (int i = 1; i + 1 < argc; ++i)
+    if (strcmp(argv[i], name) == 0)
+      return atof(argv[i + 1]);
+  return default_val;
+}
+
+// usage: w7 [--tick-rate 60], the same tick rate the server runs at
 int main(int argc, const char **argv)
 {
   if (enet_initialize() != 0)
@@ -249,13 +509,17 @@ int main(int argc, const char **argv)
   SetTargetFPS(60);               // Set our game to run at 60 frames-per-second
 
   BandwidthAccumulator bandwidthAccumulator;
+  predictionStep = FixedTimestep(get_arg(argc, argv, "--tick-rate", 60.f));
   while (!WindowShouldClose())
   {
     float dt = GetFrameTime();
 
     update_net(client, serverPeer);
+    if (lockstepMode)
+      copy_lockstep_world();
     update_bandwidth(dt, client, bandwidthAccumulator);
-    simulate_world(serverPeer);
+    simulate_world(serverPeer, dt);
+    interpolate_entities(dt);
     update_camera(camera);
     draw_world(camera, bandwidthAccumulator);
   }
@@ -0,0 +1,193 @@
+#include "memoryPool.h"
+#include <stdlib.h>
+#include <atomic>
+#include <mutex>
+#include <new>
+
+// every block carries a header with its size class so free doesn't need the size
+constexpr size_t blockHeaderSize = 16;
+constexpr size_t minClassShift = 5; // 32 bytes
+constexpr size_t numSizeClasses = 8; // up to 4096 bytes
+constexpr size_t slabSize = 64 * 1024;
+constexpr uint32_t heapBlockClass = 0xff;
+
+struct BlockHeader
+{
+  uint32_t sizeClass;
+  uint32_t size;
+  BlockHeader *next; // only meaningful while the block sits in a free list
+};
+static_assert(sizeof(BlockHeader) <= blockHeaderSize);
+
+static BlockHeader *freeLists[numSizeClasses] = {};
+static AllocatorStats stats;
+// ENet packets are created on the simulation thread and freed on the network one
+static std::mutex poolMutex;
+// bumped by operator new/delete, which may run before main and from any thread
+static std::atomic<uint64_t> newCalls{0};
+static std::atomic<uint64_t> deleteCalls{0};
+
+static size_t class_size(size_t sizeClass)
+{
+  return size_t(1) << (sizeClass + minClassShift);
+}
+
+static size_t size_class_of(size_t size)
+{
+  size_t sizeClass = 0;
+  while (sizeClass < numSizeClasses && class_size(sizeClass) < size)
+    ++sizeClass;
+  return sizeClass;
+}
+
+static void refill(size_t sizeClass)
+{
+  const size_t stride = blockHeaderSize + class_size(sizeClass);
+  const size_t count = slabSize / stride;
+  uint8_t *slab = (uint8_t*)malloc(stride * count);
+  if (!slab)
+    return;
+  ++stats.heapAllocs;
+  stats.bytesReserved += stride * count;
+  // slabs are never returned, the pool only grows to the peak working set
+  for (size_t i = 0; i < count; ++i)
+  {
+    BlockHeader *block = (BlockHeader*)(slab + i * stride);
+    block->sizeClass = sizeClass;
+    block->next = freeLists[sizeClass];
+    freeLists[sizeClass] = block;
+  }
+}
+
+void *pool_malloc(size_t size)
+{
+  const size_t sizeClass = size_class_of(size);
+  BlockHeader *block = nullptr;
+  std::lock_guard<std::mutex> lock(poolMutex);
+  if (sizeClass == numSizeClasses)
+  {
+    block = (BlockHeader*)malloc(blockHeaderSize + size);
+    if (!block)
+      return nullptr;
+    block->sizeClass = heapBlockClass;
+    ++stats.heapAllocs;
+  }
+  else
+  {
+    if (!freeLists[sizeClass])
+      refill(sizeClass);
+    block = freeLists[sizeClass];
+    if (!block)
+      return nullptr;
+    freeLists[sizeClass] = block->next;
+    ++stats.poolAllocs;
+  }
+  block->size = size;
+  stats.bytesInUse += size;
+  return (uint8_t*)block + blockHeaderSize;
+}
+
+void pool_free(void *ptr)
+{
+  if (!ptr)
+    return;
+  BlockHeader *block = (BlockHeader*)((uint8_t*)ptr - blockHeaderSize);
+  std::lock_guard<std::mutex> lock(poolMutex);
+  stats.bytesInUse -= block->size;
+  if (block->sizeClass == heapBlockClass)
+  {
+    ++stats.heapFrees;
+    free(block);
+    return;
+  }
+  block->next = freeLists[block->sizeClass];
+  freeLists[block->sizeClass] = block;
+  ++stats.poolFrees;
+}
+
+AllocatorStats get_allocator_stats()
+{
+  std::lock_guard<std::mutex> lock(poolMutex);
+  AllocatorStats result = stats;
+  result.newCalls = newCalls.load(std::memory_order_relaxed);
+  result.deleteCalls = deleteCalls.load(std::memory_order_relaxed);
+  return result;
+}
+
+// Counting replacements of the global allocation functions. The nothrow forms
+// fall back to these, aligned new isn't used by anything here.
+static void *counted_new(size_t size)
+{
+  newCalls.fetch_add(1, std::memory_order_relaxed);
+  if (void *ptr = malloc(size ? size : 1))
+    return ptr;
+  throw std::bad_alloc();
+}
+
+static void counted_delete(void *ptr)
+{
+  if (!ptr)
+    return;
+  deleteCalls.fetch_add(1, std::memory_order_relaxed);
+  free(ptr);
+}
+
+void *operator new(size_t size) { return counted_new(size); }
+void *operator new[](size_t size) { return counted_new(size); }
+void operator delete(void *ptr) noexcept { counted_delete(ptr); }
+void operator delete[](void *ptr) noexcept { counted_delete(ptr); }
+void operator delete(void *ptr, size_t) noexcept { counted_delete(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { counted_delete(ptr); }
+
+void *FrameArena::alloc(size_t size, size_t align)
+{
+  size_t offset = (used + align - 1) & ~(align - 1);
+  highWater = offset + size > highWater ? offset + size : highWater;
+  if (offset + size <= capacity)
+  {
+    used = offset + size;
+    return data + offset;
+  }
+  // spill, keep the block on a list so reset can release it
+  uint8_t *block = (uint8_t*)malloc(blockHeaderSize + size);
+  if (!block)
+    return nullptr;
+  {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    ++stats.heapAllocs;
+  }
+  *(void**)block = overflow;
+  overflow = block;
+  used = offset + size;
+  return block + blockHeaderSize;
+}
+
+void FrameArena::reset()
+{
+  std::lock_guard<std::mutex> lock(poolMutex);
+  while (overflow)
+  {
+    void *next = *(void**)overflow;
+    free(overflow);
+    ++stats.heapFrees;
+    overflow = next;
+  }
+  if (highWater > capacity)
+  {
+    free(data);
+    stats.bytesReserved -= capacity;
+    capacity = highWater * 2;
+    data = (uint8_t*)malloc(capacity);
+    capacity = data ? capacity : 0;
+    ++stats.heapAllocs;
+    stats.bytesReserved += capacity;
+  }
+  used = 0;
+  highWater = 0;
+}
+
+FrameArena &get_frame_arena()
+{
+  static FrameArena arena;
+  return arena;
+}
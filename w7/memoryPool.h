@@ -0,0 +1,46 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+// Size-class pool allocator meant to back enet_initialize_with_callbacks, plus a
+// per-tick scratch arena. Both only hit the general heap while warming up, the
+// stats let the server verify that steady state ticks don't. The pools can be
+// used from any thread, the arena belongs to the simulation thread.
+//
+// Linking this file also replaces the global operator new and delete with ones
+// that count their calls, so containers growing behind the pools' back show up
+// in the stats too.
+
+struct AllocatorStats
+{
+  uint64_t poolAllocs = 0;
+  uint64_t poolFrees = 0;
+  // slab refills, oversized blocks and arena growth
+  uint64_t heapAllocs = 0;
+  uint64_t heapFrees = 0;
+  // everything else in C++, std containers included, from every thread
+  uint64_t newCalls = 0;
+  uint64_t deleteCalls = 0;
+  size_t bytesInUse = 0;
+  size_t bytesReserved = 0;
+};
+
+void *pool_malloc(size_t size);
+void pool_free(void *ptr);
+AllocatorStats get_allocator_stats();
+
+// Bump allocator reset once per tick. Anything that doesn't fit spills to the
+// heap and the arena grows to the high water mark on the next reset.
+struct FrameArena
+{
+  uint8_t *data = nullptr;
+  size_t capacity = 0;
+  size_t used = 0;
+  size_t highWater = 0;
+  void *overflow = nullptr; // intrusive list of spilled blocks
+
+  void *alloc(size_t size, size_t align = 16);
+  void reset();
+};
+
+FrameArena &get_frame_arena();
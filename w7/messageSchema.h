@@ -0,0 +1,151 @@
+#pragma once
+#include <enet/enet.h>
+#include <cstdint>
+#include <cstddef>
+#include "bitStream.h"
+
+// Compile-time message descriptions. A schema is a list of fields, each one a
+// pointer to a struct member plus a codec; the encoder, the decoder and the
+// packet size are all generated from that single list, so the two sides of a
+// message can't drift apart.
+
+template<int num_bits>
+struct UIntCodec
+{
+  static constexpr size_t bits = num_bits;
+  template<typename T> static void write(BitWriter &writer, T value) { writer.write_bits(uint32_t(value), num_bits); }
+  template<typename T> static void read(BitReader &reader, T &value) { value = T(reader.read_bits(num_bits)); }
+};
+
+struct BoolCodec
+{
+  static constexpr size_t bits = 1;
+  static void write(BitWriter &writer, bool value) { writer.write_bool(value); }
+  static void read(BitReader &reader, bool &value) { value = reader.read_bool(); }
+};
+
+struct FloatCodec
+{
+  static constexpr size_t bits = 32;
+  static void write(BitWriter &writer, float value) { writer.write_float(value); }
+  static void read(BitReader &reader, float &value) { value = reader.read_float(); }
+};
+
+// Range is a type with static constexpr lo/hi, floats can't portably be template arguments yet
+template<typename Range, int num_bits>
+struct QuantizedCodec
+{
+  static constexpr size_t bits = num_bits;
+  static void write(BitWriter &writer, float value) { writer.write_quantized(value, Range::lo, Range::hi, num_bits); }
+  static void read(BitReader &reader, float &value) { value = reader.read_quantized(Range::lo, Range::hi, num_bits); }
+};
+
+// Where encoded packets go. `last` is false while more peers are going to be
+// handed the same packet, after the last one the packet has to be freed if no
+// peer took a reference to it.
+struct PacketSink
+{
+  void (*send)(void *user, ENetPeer *peer, uint8_t channel, ENetPacket *packet, bool last);
+  void *user;
+};
+
+// ENet reference counts packets, so one packet can be queued on any number of
+// peers. If no peer accepted it nobody will free it, so do it here.
+inline void send_to_enet(void *, ENetPeer *peer, uint8_t channel, ENetPacket *packet, bool last)
+{
+  enet_peer_send(peer, channel, packet);
+  if (last && packet->referenceCount == 0)
+    enet_packet_destroy(packet);
+}
+
+// straight into ENet by default, a thread that doesn't own the host installs its own
+inline thread_local PacketSink packetSink = {send_to_enet, nullptr};
+
+inline void send_packet(ENetPeer *peer, uint8_t channel, ENetPacket *packet)
+{
+  packetSink.send(packetSink.user, peer, channel, packet, true);
+}
+
+inline void send_shared_packet(ENetPeer *const *peers, size_t count, uint8_t channel,
+                               ENetPacket *packet)
+{
+  if (count == 0)
+    enet_packet_destroy(packet);
+  for (size_t i = 0; i < count; ++i)
+    packetSink.send(packetSink.user, peers[i], channel, packet, i + 1 == count);
+}
+
+template<auto member, typename Codec>
+struct Field
+{
+  static constexpr size_t bits = Codec::bits;
+  template<typename Msg> static void write(BitWriter &writer, const Msg &msg) { Codec::write(writer, msg.*member); }
+  template<typename Msg> static void read(BitReader &reader, Msg &msg) { Codec::read(reader, msg.*member); }
+};
+
+// field list without a header, for records embedded in bigger messages
+template<typename Msg, typename... Fields>
+struct RecordSchema
+{
+  using Message = Msg;
+  static constexpr size_t bits = (Fields::bits + ... + 0);
+
+  static void write(BitWriter &writer, const Msg &msg) { (Fields::write(writer, msg), ...); }
+  static void read(BitReader &reader, Msg &msg) { (Fields::read(reader, msg), ...); }
+};
+
+template<uint8_t type, uint8_t channel, uint32_t flags, typename Msg, typename... Fields>
+struct MessageSchema
+{
+  using Message = Msg;
+  using Record = RecordSchema<Msg, Fields...>;
+  static constexpr size_t bits = 8 + Record::bits;
+  static constexpr size_t size = (bits + 7) / 8;
+
+  static ENetPacket *create_packet(const Msg &msg)
+  {
+    uint8_t buffer[size];
+    BitWriter writer(buffer, size);
+    writer.write_bits(type, 8);
+    Record::write(writer, msg);
+    return enet_packet_create(buffer, writer.flush(), flags);
+  }
+
+  static void send(ENetPeer *peer, const Msg &msg)
+  {
+    send_packet(peer, channel, create_packet(msg));
+  }
+
+  // encodes once, every peer holds a reference to the same packet
+  static void send(ENetPeer *const *peers, size_t count, const Msg &msg)
+  {
+    send_shared_packet(peers, count, channel, create_packet(msg));
+  }
+
+  static void broadcast(ENetHost *host, const Msg &msg)
+  {
+    enet_host_broadcast(host, channel, create_packet(msg));
+  }
+
+  // returns false if the packet is shorter than the schema says
+  static bool deserialize(const ENetPacket *packet, Msg &msg)
+  {
+    BitReader reader(packet->data, packet->dataLength);
+    reader.read_bits(8);
+    Record::read(reader, msg);
+    return !reader.overflow;
+  }
+};
+
+// a message that is nothing but one record, so the field list exists only once
+template<uint8_t type, uint8_t channel, uint32_t flags, typename Record>
+struct RecordMessage;
+
+template<uint8_t type, uint8_t channel, uint32_t flags, typename Msg, typename... Fields>
+struct RecordMessage<type, channel, flags, RecordSchema<Msg, Fields...>>
+{
+  using Schema = MessageSchema<type, channel, flags, Msg, Fields...>;
+};
+
+template<uint8_t type, uint8_t channel, uint32_t flags, typename Record>
+using RecordMessageSchema = typename RecordMessage<type, channel, flags, Record>::Schema;
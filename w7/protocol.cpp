@@ -1,91 +1,365 @@
 #include "protocol.h"
 #include "quantisation.h"
-#include <cstring> // memcpy
+#include "bitStream.h"
+#include "messageSchema.h"
+#include "memoryPool.h"
 #include <iostream>
 
-void send_join(ENetPeer *peer)
+struct WorldRange { static constexpr float lo = -worldSize; static constexpr float hi = worldSize; };
+struct AngleRange { static constexpr float lo = -PI; static constexpr float hi = PI; };
+
+// 4 bit throttle/steer, snapped to exactly zero when the key isn't pressed
+struct InputAxisCodec
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t), ENET_PACKET_FLAG_RELIABLE);
-  *packet->data = E_CLIENT_TO_SERVER_JOIN;
+  static constexpr size_t bits = 4;
+  static void write(BitWriter &writer, float value) { writer.write_packed(float4bitsQuantized(value, -1.f, 1.f)); }
+  static void read(BitReader &reader, float &value)
+  {
+    static uint8_t neutralPackedValue = pack_float<uint8_t>(0.f, -1.f, 1.f, 4);
+    float4bitsQuantized packed = reader.read_packed<uint8_t, 4>();
+    value = packed.packedVal == neutralPackedValue ? 0.f : packed.unpack(-1.f, 1.f);
+  }
+};
+
+// lockstep state is sent as raw fixed point bits, no quantisation can differ between peers
+struct FixedCodec
+{
+  static constexpr size_t bits = 32;
+  static void write(BitWriter &writer, Fixed value) { writer.write_bits(uint32_t(value.raw), 32); }
+  static void read(BitReader &reader, Fixed &value) { value.raw = int32_t(reader.read_bits(32)); }
+};
+
+struct LockstepAxisCodec
+{
+  static constexpr size_t bits = 2;
+  static void write(BitWriter &writer, int8_t value) { writer.write_bits(uint32_t(value + 1), 2); }
+  static void read(BitReader &reader, int8_t &value) { value = int8_t(int(reader.read_bits(2)) - 1); }
+};
+
+struct JoinMsg {};
+struct EidMsg { uint16_t eid; };
+struct SeqMsg { uint16_t seq; };
+struct TimeMsg { uint32_t timeMsec; };
+struct EntityInputMsg { uint16_t eid; uint16_t seq; float thr; float steer; };
+struct SnapshotMsg { uint16_t eid; float x; float y; float ori; };
+
+using JoinSchema = MessageSchema<E_CLIENT_TO_SERVER_JOIN, 0, ENET_PACKET_FLAG_RELIABLE, JoinMsg>;
+using NewEntitySchema = MessageSchema<E_SERVER_TO_CLIENT_NEW_ENTITY, 0, ENET_PACKET_FLAG_RELIABLE, Entity,
+  Field<&Entity::color, UIntCodec<32>>,
+  Field<&Entity::serverControlled, BoolCodec>,
+  Field<&Entity::x, FloatCodec>,
+  Field<&Entity::y, FloatCodec>,
+  Field<&Entity::vx, FloatCodec>,
+  Field<&Entity::vy, FloatCodec>,
+  Field<&Entity::ori, FloatCodec>,
+  Field<&Entity::omega, FloatCodec>,
+  Field<&Entity::thr, FloatCodec>,
+  Field<&Entity::steer, FloatCodec>,
+  Field<&Entity::eid, UIntCodec<16>>>;
+using RemoveEntitySchema = MessageSchema<E_SERVER_TO_CLIENT_REMOVE_ENTITY, 0, ENET_PACKET_FLAG_RELIABLE, EidMsg,
+  Field<&EidMsg::eid, UIntCodec<16>>>;
+using SetControlledEntitySchema = MessageSchema<E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY, 0, ENET_PACKET_FLAG_RELIABLE, EidMsg,
+  Field<&EidMsg::eid, UIntCodec<16>>>;
+using EntityInputSchema = MessageSchema<E_CLIENT_TO_SERVER_INPUT, 1, ENET_PACKET_FLAG_UNSEQUENCED, EntityInputMsg,
+  Field<&EntityInputMsg::eid, UIntCodec<16>>,
+  Field<&EntityInputMsg::seq, UIntCodec<16>>,
+  Field<&EntityInputMsg::thr, InputAxisCodec>,
+  Field<&EntityInputMsg::steer, InputAxisCodec>>;
+using SnapshotRecord = RecordSchema<SnapshotMsg,
+  Field<&SnapshotMsg::eid, UIntCodec<16>>,
+  Field<&SnapshotMsg::x, QuantizedCodec<WorldRange, PositionXQuantized::bits>>,
+  Field<&SnapshotMsg::y, QuantizedCodec<WorldRange, PositionYQuantized::bits>>,
+  Field<&SnapshotMsg::ori, QuantizedCodec<AngleRange, OrientationQuantized::bits>>>;
+using SnapshotSchema = RecordMessageSchema<E_SERVER_TO_CLIENT_SNAPSHOT, 1, ENET_PACKET_FLAG_UNSEQUENCED, SnapshotRecord>;
+using SnapshotAckSchema = MessageSchema<E_CLIENT_TO_SERVER_SNAPSHOT_ACK, 1, ENET_PACKET_FLAG_UNSEQUENCED, SeqMsg,
+  Field<&SeqMsg::seq, UIntCodec<16>>>;
+// world snapshot entities, already quantised by pack_entity_record, as full
+// records or field by field against a baseline
+using EntityXField = Field<&EntityRecord::x, UIntCodec<PositionXQuantized::bits>>;
+using EntityYField = Field<&EntityRecord::y, UIntCodec<PositionYQuantized::bits>>;
+using EntityOriField = Field<&EntityRecord::ori, UIntCodec<OrientationQuantized::bits>>;
+using EntityVelocityRecord = RecordSchema<EntityRecord,
+  Field<&EntityRecord::vx, UIntCodec<VelocityQuantized::bits>>,
+  Field<&EntityRecord::vy, UIntCodec<VelocityQuantized::bits>>,
+  Field<&EntityRecord::omega, UIntCodec<AngularVelocityQuantized::bits>>>;
+using FullEntityRecord = RecordSchema<EntityRecord,
+  EntityXField,
+  EntityYField,
+  EntityOriField,
+  Field<&EntityRecord::vx, UIntCodec<VelocityQuantized::bits>>,
+  Field<&EntityRecord::vy, UIntCodec<VelocityQuantized::bits>>,
+  Field<&EntityRecord::omega, UIntCodec<AngularVelocityQuantized::bits>>>;
+using ControlledStateRecord = RecordSchema<ControlledState,
+  Field<&ControlledState::inputSeq, UIntCodec<16>>,
+  Field<&ControlledState::x, FloatCodec>,
+  Field<&ControlledState::y, FloatCodec>,
+  Field<&ControlledState::vx, FloatCodec>,
+  Field<&ControlledState::vy, FloatCodec>,
+  Field<&ControlledState::ori, FloatCodec>,
+  Field<&ControlledState::omega, FloatCodec>>;
+using LockstepEntityRecord = RecordSchema<LockstepEntity,
+  Field<&LockstepEntity::color, UIntCodec<32>>,
+  Field<&LockstepEntity::serverControlled, BoolCodec>,
+  Field<&LockstepEntity::x, FixedCodec>,
+  Field<&LockstepEntity::y, FixedCodec>,
+  Field<&LockstepEntity::vx, FixedCodec>,
+  Field<&LockstepEntity::vy, FixedCodec>,
+  Field<&LockstepEntity::ori, UIntCodec<16>>,
+  Field<&LockstepEntity::omega, FixedCodec>,
+  Field<&LockstepEntity::thr, LockstepAxisCodec>,
+  Field<&LockstepEntity::steer, LockstepAxisCodec>,
+  Field<&LockstepEntity::eid, UIntCodec<16>>>;
+using LockstepInputRecord = RecordSchema<LockstepInput,
+  Field<&LockstepInput::eid, UIntCodec<16>>,
+  Field<&LockstepInput::thr, LockstepAxisCodec>,
+  Field<&LockstepInput::steer, LockstepAxisCodec>>;
+using LockstepResyncSchema = MessageSchema<E_CLIENT_TO_SERVER_LOCKSTEP_RESYNC, 0, ENET_PACKET_FLAG_RELIABLE, JoinMsg>;
+using TimeMsecSchema = MessageSchema<E_SERVER_TO_CLIENT_TIME_MSEC, 0, ENET_PACKET_FLAG_RELIABLE, TimeMsg,
+  Field<&TimeMsg::timeMsec, UIntCodec<32>>>;
+
+static_assert(EntityInputSchema::size == 6);
+static_assert(SnapshotSchema::size == 7);
 
-  enet_peer_send(peer, 0, packet);
+void send_join(ENetPeer *peer)
+{
+  JoinSchema::send(peer, {});
 }
 
 void send_new_entity(ENetPeer *peer, const Entity &ent)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(Entity),
-                                                   ENET_PACKET_FLAG_RELIABLE);
-  uint8_t *ptr = packet->data;
-  *ptr = E_SERVER_TO_CLIENT_NEW_ENTITY; ptr += sizeof(uint8_t);
-  memcpy(ptr, &ent, sizeof(Entity)); ptr += sizeof(Entity);
+  NewEntitySchema::send(peer, ent);
+}
 
-  enet_peer_send(peer, 0, packet);
+void send_new_entity(ENetPeer *const *peers, size_t count, const Entity &ent)
+{
+  NewEntitySchema::send(peers, count, ent);
+}
+
+void send_remove_entity(ENetPeer *peer, uint16_t eid)
+{
+  RemoveEntitySchema::send(peer, {eid});
 }
 
 void send_set_controlled_entity(ENetPeer *peer, uint16_t eid)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t),
-                                                   ENET_PACKET_FLAG_RELIABLE);
-  uint8_t *ptr = packet->data;
-  *ptr = E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY; ptr += sizeof(uint8_t);
-  memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+  SetControlledEntitySchema::send(peer, {eid});
+}
+
+void send_entity_input(ENetPeer *peer, uint16_t eid, uint16_t seq, float thr, float steer)
+{
+  EntityInputSchema::send(peer, {eid, seq, thr, steer});
+}
 
-  enet_peer_send(peer, 0, packet);
+void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float ori)
+{
+  SnapshotSchema::send(peer, {eid, x, y, ori});
 }
 
-void send_entity_input(ENetPeer *peer, uint16_t eid, float thr, float steer)
+constexpr size_t velocityBits = EntityVelocityRecord::bits;
+constexpr size_t fullRecordBits = FullEntityRecord::bits;
+// worst case of two varints for a run of eids
+constexpr size_t runBits = 24 + 24;
+static const EntityRecord *find_baseline_record(const SnapshotFrame *baseline, size_t &idx,
+                                                uint16_t eid)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t) +
-                                                   sizeof(uint8_t),
-                                                   ENET_PACKET_FLAG_UNSEQUENCED);
-  uint8_t *ptr = packet->data;
-  *ptr = E_CLIENT_TO_SERVER_INPUT; ptr += sizeof(uint8_t);
-  memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
-  float4bitsQuantized thrPacked(thr, -1.f, 1.f);
-  float4bitsQuantized steerPacked(steer, -1.f, 1.f);
-  uint8_t thrSteerPacked = (thrPacked.packedVal << 4) | steerPacked.packedVal;
-  memcpy(ptr, &thrSteerPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
-  /*
-  memcpy(ptr, &thrPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
-  memcpy(ptr, &oriPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
-  */
+  if (!baseline)
+    return nullptr;
+  const std::vector<EntityRecord> &records = baseline->records;
+  while (idx < records.size() && records[idx].eid < eid)
+    ++idx;
+  return idx < records.size() && records[idx].eid == eid ? &records[idx] : nullptr;
+}
 
-  enet_peer_send(peer, 1, packet);
+static bool velocity_changed(const EntityRecord &rec, const EntityRecord &base)
+{
+  return rec.vx != base.vx || rec.vy != base.vy || rec.omega != base.omega;
 }
 
-typedef PackedFloat<uint16_t, 11> PositionXQuantized;
-typedef PackedFloat<uint16_t, 10> PositionYQuantized;
+// a record resampled with the same state still has to tell the client its new time
+static bool record_changed(const EntityRecord &rec, const EntityRecord &base)
+{
+  return !(rec == base) || rec.time != base.time;
+}
 
-void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float ori)
+size_t snapshot_record_bits(const EntityRecord &rec, const EntityRecord *base)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint16_t) +
-                                                   sizeof(uint16_t) +
-                                                   sizeof(uint16_t) +
-                                                   sizeof(uint8_t),
-                                                   ENET_PACKET_FLAG_UNSEQUENCED);
-  uint8_t *ptr = packet->data;
-  *ptr = E_SERVER_TO_CLIENT_SNAPSHOT; ptr += sizeof(uint8_t);
-  memcpy(ptr, &eid, sizeof(uint16_t)); ptr += sizeof(uint16_t);
-  PositionXQuantized xPacked(x, -worldSize, worldSize);
-  PositionYQuantized yPacked(y, -worldSize, worldSize);
-  uint8_t oriPacked = pack_float<uint8_t>(ori, -PI, PI, 8);
-  //printf("xPacked/unpacked %d %f\n", xPacked, x);
-  memcpy(ptr, &xPacked.packedVal, sizeof(uint16_t)); ptr += sizeof(uint16_t);
-  memcpy(ptr, &yPacked.packedVal, sizeof(uint16_t)); ptr += sizeof(uint16_t);
-  memcpy(ptr, &oriPacked, sizeof(uint8_t)); ptr += sizeof(uint8_t);
-
-  enet_peer_send(peer, 1, packet);
+  if (!base)
+    return fullRecordBits;
+  if (!record_changed(rec, *base))
+    return 1;
+  return 1 + 4 + (rec.x != base->x ? EntityXField::bits : 0) + (rec.y != base->y ? EntityYField::bits : 0) +
+                 (rec.ori != base->ori ? EntityOriField::bits : 0) + (velocity_changed(rec, *base) ? velocityBits : 0);
+}
+
+size_t send_world_snapshot(ENetPeer *peer, const SnapshotFrame *baseline,
+                           const std::vector<EntityRecord> &records, SnapshotFrame &sent)
+{
+  // first decide what fits, entities that don't fit keep their baseline state
+  size_t budgetBits = maxSnapshotPacketSize * 8 - (8 + 16 + 32 + 1 + 16 + 1 + 24);
+  if (sent.hasControlled)
+    budgetBits -= ControlledStateRecord::bits;
+  size_t baseIdx = 0;
+  uint16_t prevEid = invalid_entity;
+  for (const EntityRecord &rec : records)
+  {
+    const EntityRecord *base = find_baseline_record(baseline, baseIdx, rec.eid);
+    size_t runCost = sent.records.empty() || rec.eid != uint16_t(prevEid + 1) ? runBits : 0;
+    size_t cost = runCost + snapshot_record_bits(rec, base);
+    if (cost <= budgetBits)
+      sent.records.push_back(rec);
+    else if (base && runCost + 1 <= budgetBits)
+    {
+      sent.records.push_back(*base);
+      cost = runCost + 1;
+    }
+    else
+      continue;
+    budgetBits -= cost;
+    prevEid = rec.eid;
+  }
+
+  uint8_t *buffer = (uint8_t*)get_frame_arena().alloc(maxSnapshotPacketSize);
+  if (!buffer)
+    return 0;
+  BitWriter writer(buffer, maxSnapshotPacketSize);
+  writer.write_bits(E_SERVER_TO_CLIENT_WORLD_SNAPSHOT, 8);
+  writer.write_bits(sent.seq, 16);
+  writer.write_bits(sent.serverTime, 32);
+  writer.write_bool(baseline != nullptr);
+  if (baseline)
+    writer.write_bits(baseline->seq, 16);
+  writer.write_bool(sent.hasControlled);
+  if (sent.hasControlled)
+    ControlledStateRecord::write(writer, sent.controlled);
+
+  // entity set as runs of consecutive eids, each starting at an offset from the previous one
+  uint32_t numRuns = 0;
+  for (size_t i = 0; i < sent.records.size(); ++i)
+    if (i == 0 || sent.records[i].eid != uint16_t(sent.records[i - 1].eid + 1))
+      ++numRuns;
+  writer.write_varint(numRuns);
+  uint16_t runStart = 0;
+  for (size_t i = 0; i < sent.records.size();)
+  {
+    size_t end = i + 1;
+    while (end < sent.records.size() && sent.records[end].eid == uint16_t(sent.records[end - 1].eid + 1))
+      ++end;
+    writer.write_varint(uint16_t(sent.records[i].eid - runStart));
+    writer.write_varint(end - i);
+    runStart = sent.records[end - 1].eid;
+    i = end;
+  }
+
+  baseIdx = 0;
+  for (const EntityRecord &rec : sent.records)
+  {
+    const EntityRecord *base = find_baseline_record(baseline, baseIdx, rec.eid);
+    if (!base)
+    {
+      FullEntityRecord::write(writer, rec);
+      continue;
+    }
+    // unchanged entities cost a single bit
+    writer.write_bool(record_changed(rec, *base));
+    if (!record_changed(rec, *base))
+      continue;
+    writer.write_bool(rec.x != base->x);
+    if (rec.x != base->x)
+      EntityXField::write(writer, rec);
+    writer.write_bool(rec.y != base->y);
+    if (rec.y != base->y)
+      EntityYField::write(writer, rec);
+    writer.write_bool(rec.ori != base->ori);
+    if (rec.ori != base->ori)
+      EntityOriField::write(writer, rec);
+    writer.write_bool(velocity_changed(rec, *base));
+    if (velocity_changed(rec, *base))
+      EntityVelocityRecord::write(writer, rec);
+  }
+
+  size_t size = writer.flush();
+  send_packet(peer, 1, enet_packet_create(buffer, size, ENET_PACKET_FLAG_UNSEQUENCED));
+  return size;
+}
+
+void send_snapshot_ack(ENetPeer *peer, uint16_t seq)
+{
+  SnapshotAckSchema::send(peer, {seq});
 }
 
 void send_time_msec(ENetPeer *peer, uint32_t timeMsec)
 {
-  ENetPacket *packet = enet_packet_create(nullptr, sizeof(uint8_t) + sizeof(uint32_t),
-                                                   ENET_PACKET_FLAG_RELIABLE);
-  uint8_t *ptr = packet->data;
-  *ptr = E_SERVER_TO_CLIENT_TIME_MSEC; ptr += sizeof(uint8_t);
-  memcpy(ptr, &timeMsec, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+  TimeMsecSchema::send(peer, {timeMsec});
+}
+
+void broadcast_time_msec(ENetHost *host, uint32_t timeMsec)
+{
+  TimeMsecSchema::broadcast(host, {timeMsec});
+}
+
+static void write_uint64(BitWriter &writer, uint64_t value)
+{
+  writer.write_bits(uint32_t(value), 32);
+  writer.write_bits(uint32_t(value >> 32), 32);
+}
+
+static uint64_t read_uint64(BitReader &reader)
+{
+  const uint64_t lo = reader.read_bits(32);
+  return lo | uint64_t(reader.read_bits(32)) << 32;
+}
+
+// a varint is at most 5 bytes
+constexpr size_t lockstepStateHeaderBytes = 1 + 8 + 4 + 4 + 5;
 
-  enet_peer_send(peer, 0, packet);
+void send_lockstep_state(ENetPeer *peer, const LockstepWorld &world)
+{
+  const size_t capacity = lockstepStateHeaderBytes + (world.entities.size() * LockstepEntityRecord::bits + 7) / 8;
+  uint8_t *buffer = (uint8_t*)get_frame_arena().alloc(capacity);
+  if (!buffer)
+    return;
+  BitWriter writer(buffer, capacity);
+  writer.write_bits(E_SERVER_TO_CLIENT_LOCKSTEP_STATE, 8);
+  write_uint64(writer, world.seed);
+  writer.write_bits(world.tick, 32);
+  writer.write_bits(uint32_t(world.dt.raw), 32);
+  writer.write_varint(uint32_t(world.entities.size()));
+  for (const LockstepEntity &e : world.entities)
+    LockstepEntityRecord::write(writer, e);
+  send_packet(peer, 0, enet_packet_create(buffer, writer.flush(), ENET_PACKET_FLAG_RELIABLE));
+}
+
+// reliable and on the same channel as the state, so a client sees every frame after it in order
+void send_lockstep_frame(ENetPeer *const *peers, size_t count, const LockstepFrame &frame)
+{
+  const size_t capacity = 1 + 4 + 3 * 5 + 1 + 8 +
+                          (frame.spawns.size() * LockstepEntityRecord::bits +
+                           frame.despawns.size() * 16 +
+                           frame.inputs.size() * LockstepInputRecord::bits + 7) / 8;
+  uint8_t *buffer = (uint8_t*)get_frame_arena().alloc(capacity);
+  if (!buffer)
+    return;
+  BitWriter writer(buffer, capacity);
+  writer.write_bits(E_SERVER_TO_CLIENT_LOCKSTEP_FRAME, 8);
+  writer.write_bits(frame.tick, 32);
+  writer.write_varint(uint32_t(frame.spawns.size()));
+  for (const LockstepEntity &e : frame.spawns)
+    LockstepEntityRecord::write(writer, e);
+  writer.write_varint(uint32_t(frame.despawns.size()));
+  for (uint16_t eid : frame.despawns)
+    writer.write_bits(eid, 16);
+  writer.write_varint(uint32_t(frame.inputs.size()));
+  for (const LockstepInput &input : frame.inputs)
+    LockstepInputRecord::write(writer, input);
+  writer.write_bool(frame.hasChecksum);
+  if (frame.hasChecksum)
+    write_uint64(writer, frame.checksum);
+  send_shared_packet(peers, count, 0, enet_packet_create(buffer, writer.flush(), ENET_PACKET_FLAG_RELIABLE));
+}
+
+void send_lockstep_resync(ENetPeer *peer)
+{
+  LockstepResyncSchema::send(peer, {});
 }
 
 MessageType get_packet_type(ENetPacket *packet)
@@ -95,50 +369,168 @@ MessageType get_packet_type(ENetPacket *packet)
 
 void deserialize_new_entity(ENetPacket *packet, Entity &ent)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  ent = *(Entity*)(ptr); ptr += sizeof(Entity);
+  NewEntitySchema::deserialize(packet, ent);
+}
+
+void deserialize_remove_entity(ENetPacket *packet, uint16_t &eid)
+{
+  EidMsg msg = {invalid_entity};
+  RemoveEntitySchema::deserialize(packet, msg);
+  eid = msg.eid;
 }
 
 void deserialize_set_controlled_entity(ENetPacket *packet, uint16_t &eid)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
+  EidMsg msg = {invalid_entity};
+  SetControlledEntitySchema::deserialize(packet, msg);
+  eid = msg.eid;
 }
 
-void deserialize_entity_input(ENetPacket *packet, uint16_t &eid, float &thr, float &steer)
+void deserialize_entity_input(ENetPacket *packet, uint16_t &eid, uint16_t &seq, float &thr, float &steer)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  uint8_t thrSteerPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  /*
-  uint8_t thrPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  uint8_t oriPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  */
-  static uint8_t neutralPackedValue = pack_float<uint8_t>(0.f, -1.f, 1.f, 4);
-  static uint8_t nominalPackedValue = pack_float<uint8_t>(1.f, 0.f, 1.2f, 4);
-  float4bitsQuantized thrPacked(thrSteerPacked >> 4);
-  float4bitsQuantized steerPacked(thrSteerPacked & 0x0f);
-  thr = thrPacked.packedVal == neutralPackedValue ? 0.f : thrPacked.unpack(-1.f, 1.f);
-  steer = steerPacked.packedVal == neutralPackedValue ? 0.f : steerPacked.unpack(-1.f, 1.f);
+  EntityInputMsg msg;
+  if (!EntityInputSchema::deserialize(packet, msg))
+    msg.eid = invalid_entity;
+  eid = msg.eid;
+  seq = msg.seq;
+  thr = msg.thr;
+  steer = msg.steer;
 }
 
 void deserialize_snapshot(ENetPacket *packet, uint16_t &eid, float &x, float &y, float &ori)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  eid = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  uint16_t xPacked = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  uint16_t yPacked = *(uint16_t*)(ptr); ptr += sizeof(uint16_t);
-  PositionXQuantized xPackedVal(xPacked);
-  PositionYQuantized yPackedVal(yPacked);
-  uint8_t oriPacked = *(uint8_t*)(ptr); ptr += sizeof(uint8_t);
-  x = xPackedVal.unpack(-worldSize, worldSize);
-  y = yPackedVal.unpack(-worldSize, worldSize);
-  ori = unpack_float<uint8_t>(oriPacked, -PI, PI, 8);
+  SnapshotMsg msg;
+  if (!SnapshotSchema::deserialize(packet, msg))
+    msg.eid = invalid_entity;
+  eid = msg.eid;
+  x = msg.x;
+  y = msg.y;
+  ori = msg.ori;
+}
+
+bool deserialize_world_snapshot(ENetPacket *packet, const SnapshotHistory &history,
+                                SnapshotFrame &frame)
+{
+  BitReader reader(packet->data, packet->dataLength);
+  reader.read_bits(8);
+  frame.seq = reader.read_bits(16);
+  frame.serverTime = reader.read_bits(32);
+  frame.records.clear();
+  const SnapshotFrame *baseline = nullptr;
+  if (reader.read_bool())
+  {
+    baseline = history.find(reader.read_bits(16));
+    if (!baseline)
+      return false;
+  }
+  frame.hasControlled = reader.read_bool();
+  if (frame.hasControlled)
+    ControlledStateRecord::read(reader, frame.controlled);
+
+  uint32_t numRuns = reader.read_varint();
+  uint16_t runStart = 0;
+  for (uint32_t run = 0; run < numRuns && !reader.overflow; ++run)
+  {
+    uint16_t firstEid = runStart + reader.read_varint();
+    uint32_t count = reader.read_varint();
+    // every entity costs at least one bit, so a larger count can only be garbage
+    if (count == 0 || count > reader.get_bits_remaining())
+      return false;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+      EntityRecord rec;
+      rec.eid = firstEid + i;
+      frame.records.push_back(rec);
+    }
+    runStart = frame.records.back().eid;
+  }
+
+  size_t baseIdx = 0;
+  for (EntityRecord &rec : frame.records)
+  {
+    const EntityRecord *base = find_baseline_record(baseline, baseIdx, rec.eid);
+    if (!base)
+    {
+      FullEntityRecord::read(reader, rec);
+      rec.time = frame.serverTime;
+      continue;
+    }
+    rec = *base;
+    if (!reader.read_bool())
+      continue;
+    rec.time = frame.serverTime;
+    if (reader.read_bool())
+      EntityXField::read(reader, rec);
+    if (reader.read_bool())
+      EntityYField::read(reader, rec);
+    if (reader.read_bool())
+      EntityOriField::read(reader, rec);
+    if (reader.read_bool())
+      EntityVelocityRecord::read(reader, rec);
+  }
+  return !reader.overflow;
+}
+
+void deserialize_snapshot_ack(ENetPacket *packet, uint16_t &seq)
+{
+  SeqMsg msg = {seq};
+  SnapshotAckSchema::deserialize(packet, msg);
+  seq = msg.seq;
 }
 
 void deserialize_time_msec(ENetPacket *packet, uint32_t &timeMsec)
 {
-  uint8_t *ptr = packet->data; ptr += sizeof(uint8_t);
-  timeMsec = *(uint32_t*)(ptr); ptr += sizeof(uint32_t);
+  TimeMsg msg = {timeMsec};
+  TimeMsecSchema::deserialize(packet, msg);
+  timeMsec = msg.timeMsec;
+}
+
+bool deserialize_lockstep_state(ENetPacket *packet, LockstepWorld &world)
+{
+  BitReader reader(packet->data, packet->dataLength);
+  reader.read_bits(8);
+  const uint64_t seed = read_uint64(reader);
+  const uint32_t tick = reader.read_bits(32);
+  const Fixed dt = Fixed::from_raw(int32_t(reader.read_bits(32)));
+  const uint32_t count = reader.read_varint();
+  if (count > reader.get_bits_remaining() / LockstepEntityRecord::bits)
+    return false;
+  world.reset(seed, tick, dt);
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    LockstepEntity e;
+    LockstepEntityRecord::read(reader, e);
+    world.spawn(e);
+  }
+  return !reader.overflow;
 }
 
+bool deserialize_lockstep_frame(ENetPacket *packet, LockstepFrame &frame)
+{
+  BitReader reader(packet->data, packet->dataLength);
+  reader.read_bits(8);
+  frame.clear();
+  frame.tick = reader.read_bits(32);
+  const uint32_t numSpawns = reader.read_varint();
+  if (numSpawns > reader.get_bits_remaining() / LockstepEntityRecord::bits)
+    return false;
+  frame.spawns.resize(numSpawns);
+  for (LockstepEntity &e : frame.spawns)
+    LockstepEntityRecord::read(reader, e);
+  const uint32_t numDespawns = reader.read_varint();
+  if (numDespawns > reader.get_bits_remaining() / 16)
+    return false;
+  frame.despawns.resize(numDespawns);
+  for (uint16_t &eid : frame.despawns)
+    eid = reader.read_bits(16);
+  const uint32_t numInputs = reader.read_varint();
+  if (numInputs > reader.get_bits_remaining() / LockstepInputRecord::bits)
+    return false;
+  frame.inputs.resize(numInputs);
+  for (LockstepInput &input : frame.inputs)
+    LockstepInputRecord::read(reader, input);
+  frame.hasChecksum = reader.read_bool();
+  if (frame.hasChecksum)
+    frame.checksum = read_uint64(reader);
+  return !reader.overflow;
+}
@@ -2,6 +2,11 @@
 #include <enet/enet.h>
 #include <cstdint>
 #include "entity.h"
+#include "snapshot.h"
+#include "lockstep.h"
+
+// keep world snapshots below ENet's default MTU so they are never fragmented
+constexpr size_t maxSnapshotPacketSize = 1200;
 
 enum MessageType : uint8_t
 {
@@ -10,21 +15,52 @@ enum MessageType : uint8_t
   E_SERVER_TO_CLIENT_SET_CONTROLLED_ENTITY,
   E_CLIENT_TO_SERVER_INPUT,
   E_SERVER_TO_CLIENT_SNAPSHOT,
-  E_SERVER_TO_CLIENT_TIME_MSEC
+  E_SERVER_TO_CLIENT_TIME_MSEC,
+  E_SERVER_TO_CLIENT_WORLD_SNAPSHOT,
+  E_CLIENT_TO_SERVER_SNAPSHOT_ACK,
+  E_SERVER_TO_CLIENT_REMOVE_ENTITY,
+  E_SERVER_TO_CLIENT_LOCKSTEP_STATE,
+  E_SERVER_TO_CLIENT_LOCKSTEP_FRAME,
+  E_CLIENT_TO_SERVER_LOCKSTEP_RESYNC
 };
 
 void send_join(ENetPeer *peer);
 void send_new_entity(ENetPeer *peer, const Entity &ent);
+// encode once and share a single packet between all the given peers
+void send_new_entity(ENetPeer *const *peers, size_t count, const Entity &ent);
+void send_remove_entity(ENetPeer *peer, uint16_t eid);
 void send_set_controlled_entity(ENetPeer *peer, uint16_t eid);
-void send_entity_input(ENetPeer *peer, uint16_t eid, float thr, float steer);
+void send_entity_input(ENetPeer *peer, uint16_t eid, uint16_t seq, float thr, float steer);
 void send_snapshot(ENetPeer *peer, uint16_t eid, float x, float y, float ori);
+// encodes `records` (sorted by eid) into one MTU-sized packet as a bit-level delta
+// against `baseline` (may be null), `sent` receives what the client will end up with
+// and carries the peer's own ship state if `sent.hasControlled` is set
+// returns the packet size in bytes
+size_t send_world_snapshot(ENetPeer *peer, const SnapshotFrame *baseline,
+                           const std::vector<EntityRecord> &records, SnapshotFrame &sent);
+// bits a single record costs in a world snapshot, not counting the eid runs
+size_t snapshot_record_bits(const EntityRecord &rec, const EntityRecord *base);
+void send_snapshot_ack(ENetPeer *peer, uint16_t seq);
 void send_time_msec(ENetPeer *peer, uint32_t timeMsec);
+void broadcast_time_msec(ENetHost *host, uint32_t timeMsec);
+// lockstep mode, the full world for joining or desynced clients, then a frame per tick
+void send_lockstep_state(ENetPeer *peer, const LockstepWorld &world);
+void send_lockstep_frame(ENetPeer *const *peers, size_t count, const LockstepFrame &frame);
+void send_lockstep_resync(ENetPeer *peer);
 
 MessageType get_packet_type(ENetPacket *packet);
 
 void deserialize_new_entity(ENetPacket *packet, Entity &ent);
+void deserialize_remove_entity(ENetPacket *packet, uint16_t &eid);
 void deserialize_set_controlled_entity(ENetPacket *packet, uint16_t &eid);
-void deserialize_entity_input(ENetPacket *packet, uint16_t &eid, float &thr, float &steer);
+void deserialize_entity_input(ENetPacket *packet, uint16_t &eid, uint16_t &seq, float &thr, float &steer);
 void deserialize_snapshot(ENetPacket *packet, uint16_t &eid, float &x, float &y, float &ori);
+// returns false if the packet is malformed or its baseline is no longer in history
+bool deserialize_world_snapshot(ENetPacket *packet, const SnapshotHistory &history,
+                                SnapshotFrame &frame);
+void deserialize_snapshot_ack(ENetPacket *packet, uint16_t &seq);
 void deserialize_time_msec(ENetPacket *packet, uint32_t &timeMsec);
+// both return false if the packet is malformed
+bool deserialize_lockstep_state(ENetPacket *packet, LockstepWorld &world);
+bool deserialize_lockstep_frame(ENetPacket *packet, LockstepFrame &frame);
 
@@ -19,6 +19,7 @@ float unpack_float(T c, float lo, float hi, int num_bits)
 template<typename T, int num_bits>
 struct PackedFloat
 {
+  static constexpr int bits = num_bits;
   T packedVal;
 
   PackedFloat(float v, float lo, float hi) { pack(v, lo, hi); }
@@ -29,4 +30,9 @@ struct PackedFloat
 };
 
 typedef PackedFloat<uint8_t, 4> float4bitsQuantized;
+typedef PackedFloat<uint16_t, 11> PositionXQuantized;
+typedef PackedFloat<uint16_t, 10> PositionYQuantized;
+typedef PackedFloat<uint8_t, 8> OrientationQuantized;
+typedef PackedFloat<uint16_t, 10> VelocityQuantized;
+typedef PackedFloat<uint16_t, 9> AngularVelocityQuantized;
 
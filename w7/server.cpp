@@ -1,147 +1,810 @@
 #include <enet/enet.h>
 #include <iostream>
 #include "entity.h"
+#include "entityStore.h"
+#include "lockstep.h"
+#include "ai.h"
+#include "jobSystem.h"
 #include "protocol.h"
 #include "mathUtils.h"
+#include "snapshot.h"
+#include "snapshotScheduler.h"
+#include "interestGrid.h"
+#include "memoryPool.h"
+#include "entityHistory.h"
+#include "fixedTimestep.h"
+#include "eventLoop.h"
+#include "spscQueue.h"
+#include "messageSchema.h"
+#include "journal.h"
+#include "rng.h"
 #include <stdlib.h>
+#include <string.h>
 #include <vector>
-#include <map>
+#include <deque>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <random>
 
-static std::vector<Entity> entities;
-static std::map<uint16_t, ENetPeer*> controlledMap;
+static EntityStore entities;
+static EidAllocator eidAllocator;
+// the AI and every spawn derive from it, --seed replays a session
+static uint64_t worldSeed = 0;
+// spawns happen on the simulation thread only
+static Rng spawnRng(0);
 
-void on_join(ENetPacket *packet, ENetPeer *peer, ENetHost *host)
+// --lockstep: clients run the same fixed point simulation and only get the
+// inputs, `entities` stays empty and no snapshots are sent
+static bool lockstep = false;
+static LockstepWorld lockstepWorld;
+// what happens at the start of the next lockstep tick
+static LockstepFrame lockstepFrame;
+
+// lag compensation, a second of the world at the default tick rate
+constexpr size_t lagCompensationTicks = 64;
+constexpr size_t maxRecordedEntities = 1024;
+static EntityHistory entityHistory(lagCompensationTicks, maxRecordedEntities, worldSize);
+
+static float interestRadius = 50.f;
+static InterestGrid interestGrid(worldSize, interestRadius);
+// snapshot bandwidth cap per peer, bytes per second
+static float peerBandwidth = 32768.f;
+// rough ENet + UDP/IP header cost of a packet
+constexpr float packetOverheadBytes = 40.f;
+// --dr-error and --dr-max-age
+static DeadReckoningLimits deadReckoning;
+
+constexpr size_t no_entity_index = size_t(-1);
+
+struct PeerState
 {
-  // send all entities
-  for (const Entity &ent : entities)
-    send_new_entity(peer, ent);
+  // area of interest, eids the client was told about, sorted
+  size_t controlledIdx = no_entity_index;
+  std::vector<uint16_t> visible;
 
-  // find max eid
-  uint16_t maxEid = entities.empty() ? invalid_entity : entities[0].eid;
-  for (const Entity &e : entities)
-    maxEid = std::max(maxEid, e.eid);
-  uint16_t newEid = maxEid + 1;
-  uint32_t color = 0x000000ff +
-                   0x44000000 * (rand() % 4 + 1) +
-                   0x00440000 * (rand() % 4 + 1) +
-                   0x00004400 * (rand() % 4 + 1);
-  float x = (rand() % 4) * 5.f;
-  float y = (rand() % 4) * 5.f;
-  Entity ent = {color, false, x, y, 0.f, (rand() / RAND_MAX) * 3.141592654f, 0.f, 0.f, 0.f, 0.f, newEid};
-  entities.push_back(ent);
+  // bandwidth scheduling, priorities run parallel to `visible`
+  std::vector<float> priority;
+  float budgetBytes = 0.f;
+
+  // delta compression
+  SnapshotHistory history;
+  uint16_t nextSeq = 0;
+  uint16_t ackedSeq = 0;
+  bool hasAck = false;
+
+  // the ship this peer steers
+  EntityHandle controlled = invalid_handle;
+
+  // prediction, newest input applied to the controlled ship (client counts from 1)
+  uint16_t lastInputSeq = 0;
+
+  // lockstep mode, the ship (spawned with the next frame), its newest input and
+  // whether the peer has the world to apply frames to
+  uint16_t lockstepShip = invalid_entity;
+  int8_t lockstepThr = 0;
+  int8_t lockstepSteer = 0;
+  bool lockstepSynced = false;
+
+  // the simulation's copy of what the network thread knows about the peer
+  bool connected = false;
+  uint32_t incomingBandwidth = 0;
+  // ENet's id of this connection, a slot reused by the next client gets a new one
+  uint32_t connectID = 0;
+};
+// indexed by peer - host->peers
+static std::vector<PeerState> peerStates;
+
+// The network thread owns the ENetHost, the simulation thread only ever sees
+// decoded events and hands back encoded packets, both through lock-free queues.
+// Peer pointers are only used as handles on the simulation side.
+enum NetEventType : uint8_t
+{
+  E_NET_CONNECT = 0,
+  E_NET_DISCONNECT,
+  E_NET_JOIN,
+  E_NET_INPUT,
+  E_NET_SNAPSHOT_ACK,
+  E_NET_LOCKSTEP_RESYNC
+};
+
+struct NetEvent
+{
+  NetEventType type;
+  uint16_t peerIdx;
+  uint16_t eid;
+  uint16_t seq;
+  float thr;
+  float steer;
+  uint32_t incomingBandwidth;
+  uint32_t connectID;
+};
+
+struct OutgoingPacket
+{
+  ENetPacket *packet;
+  // only delivered while the slot still holds the connection it was meant for
+  uint32_t connectID;
+  uint16_t peerIdx;
+  uint8_t channel;
+  bool last;
+};
+
+// --journal: every event the simulation applies, to replay the session with w7_replay
+static JournalWriter journal;
+
+// journal event types are net event types, journals stay readable if either grows
+static_assert(int(E_JOURNAL_LOCKSTEP_RESYNC) == int(E_NET_LOCKSTEP_RESYNC));
+
+static JournalRecord to_journal_record(uint32_t tick, const NetEvent &event)
+{
+  JournalRecord record = {};
+  record.tick = tick;
+  record.peer = event.peerIdx;
+  record.type = JournalEventType(event.type);
+  record.eid = event.eid;
+  record.seq = event.seq;
+  record.thr = event.thr;
+  record.steer = event.steer;
+  record.value = event.incomingBandwidth;
+  return record;
+}
+
+static NetEvent from_journal_record(const JournalRecord &record)
+{
+  NetEvent event = {};
+  event.type = NetEventType(record.type);
+  event.peerIdx = record.peer;
+  event.eid = record.eid;
+  event.seq = record.seq;
+  event.thr = record.thr;
+  event.steer = record.steer;
+  event.incomingBandwidth = record.value;
+  return event;
+}
 
-  controlledMap[newEid] = peer;
+static SpscQueue<NetEvent, 4096> netEvents;
+static SpscQueue<OutgoingPacket, 16384> outgoingPackets;
+// Neither thread ever spins on a full queue, each would wait for the other.
+// What can't be dropped waits here, on the pushing side, and goes first next time.
+static std::deque<NetEvent> deferredNetEvents;
+static std::deque<OutgoingPacket> deferredPackets;
+static ENetPeer *hostPeers = nullptr;
 
+void on_join(ENetPeer *peer, uint32_t tick)
+{
+  // entities around the new ship are sent by the interest management
+
+  const uint16_t newEid = eidAllocator.allocate(tick);
+  if (newEid == invalid_entity)
+    return; // the world is full
+  uint32_t color = 0x000000ff +
+                   0x44000000 * (spawnRng.below(4) + 1) +
+                   0x00440000 * (spawnRng.below(4) + 1) +
+                   0x00004400 * (spawnRng.below(4) + 1);
+  float x = spawnRng.below(4) * 5.f;
+  float y = spawnRng.below(4) * 5.f;
+  Entity ent = {color, false, x, y, 0.f, spawnRng.uniform() * PI, 0.f, 0.f, 0.f, 0.f, newEid};
+  if (lockstep)
+  {
+    // everyone spawns it with the next frame, the peer gets the world right after
+    lockstepFrame.spawns.push_back(to_lockstep_entity(ent));
+    peerStates[peer - hostPeers].lockstepShip = newEid;
+  }
+  else
+    peerStates[peer - hostPeers].controlled = entities.push_back(ent);
 
-  // send info about new entity to everyone
-  for (size_t i = 0; i < host->peerCount; ++i)
-    send_new_entity(&host->peers[i], ent);
   // send info about controlled entity
   send_set_controlled_entity(peer, newEid);
 }
 
-void create_server_entity(ENetHost *host)
+void create_server_entity(uint32_t tick)
 {
-  // find max eid
-  uint16_t maxEid = entities.empty() ? invalid_entity : entities[0].eid;
-  for (const Entity &e : entities)
-    maxEid = std::max(maxEid, e.eid);
-  uint16_t newEid = maxEid + 1;
+  const uint16_t newEid = eidAllocator.allocate(tick);
+  if (newEid == invalid_entity)
+    return;
   uint32_t color = 0xff000000 +
-                   0x00440000 * (rand() % 5) +
-                   0x00004400 * (rand() % 5) +
-                   0x00000044 * (rand() % 5);
-  float x = rand() % int(worldSize * 2) - worldSize;
-  float y = rand() % int(worldSize * 2) - worldSize;
-  Entity ent = {color, true, x, y, 0.f, (rand() / RAND_MAX) * 3.141592654f, 0.f, 0.f, 0.f, 0.f, newEid};
-  entities.push_back(ent);
+                   0x00440000 * spawnRng.below(5) +
+                   0x00004400 * spawnRng.below(5) +
+                   0x00000044 * spawnRng.below(5);
+  float x = float(spawnRng.below(uint32_t(worldSize * 2))) - worldSize;
+  float y = float(spawnRng.below(uint32_t(worldSize * 2))) - worldSize;
+  Entity ent = {color, true, x, y, 0.f, spawnRng.uniform() * PI, 0.f, 0.f, 0.f, 0.f, newEid};
+  if (lockstep)
+    lockstepWorld.spawn(to_lockstep_entity(ent));
+  else
+    entities.push_back(ent);
+}
+
+
+// the ship leaves with its pilot, other clients lose it through interest management
+void on_leave(uint16_t peer_idx, uint32_t tick)
+{
+  PeerState &state = peerStates[peer_idx];
+  state.connected = false;
+  if (entities.remove(state.controlled))
+    eidAllocator.release(handle_eid(state.controlled), tick);
+  state.controlled = invalid_handle;
+  if (state.lockstepShip != invalid_entity)
+  {
+    lockstepFrame.despawns.push_back(state.lockstepShip);
+    eidAllocator.release(state.lockstepShip, tick);
+    state.lockstepShip = invalid_entity;
+  }
+}
 
-  // send info about new entity to everyone
-  for (size_t i = 0; i < host->peerCount; ++i)
-    send_new_entity(&host->peers[i], ent);
+void on_input(const NetEvent &input)
+{
+  PeerState &state = peerStates[input.peerIdx];
+  if (lockstep)
+  {
+    // goes out with the next frame if it changes anything
+    if (input.eid != state.lockstepShip || !seq_greater(input.seq, state.lastInputSeq))
+      return;
+    state.lastInputSeq = input.seq;
+    state.lockstepThr = to_lockstep_axis(input.thr);
+    state.lockstepSteer = to_lockstep_axis(input.steer);
+    return;
+  }
+  // only steer your own ship
+  const uint32_t idx = entities.find(state.controlled);
+  if (idx == EntityRegistry::npos || input.eid != handle_eid(state.controlled))
+    return;
+  // inputs are unsequenced, a late one must not undo a newer one
+  if (!seq_greater(input.seq, state.lastInputSeq))
+    return;
+  state.lastInputSeq = input.seq;
+  entities.thr[idx] = input.thr;
+  entities.steer[idx] = input.steer;
 }
 
+void on_snapshot_ack(const NetEvent &ack)
+{
+  PeerState &state = peerStates[ack.peerIdx];
+  // acks are unsequenced, only ever move forward to a frame we still remember
+  if (state.hasAck && !seq_greater(ack.seq, state.ackedSeq))
+    return;
+  if (!state.history.find(ack.seq))
+    return;
+  state.ackedSeq = ack.seq;
+  state.hasAck = true;
+}
 
-void on_input(ENetPacket *packet)
+// network thread, hands over what the simulation couldn't take yet, in order
+static bool flush_deferred_net_events()
 {
-  uint16_t eid = invalid_entity;
-  float thr = 0.f; float steer = 0.f;
-  deserialize_entity_input(packet, eid, thr, steer);
-  for (Entity &e : entities)
-    if (e.eid == eid)
-    {
-      e.thr = thr;
-      e.steer = steer;
-    }
+  while (!deferredNetEvents.empty() && netEvents.push(deferredNetEvents.front()))
+    deferredNetEvents.pop_front();
+  return deferredNetEvents.empty();
+}
+
+// network thread, never waits for the simulation: inputs and acks are superseded
+// by the next one anyway, everything else waits its turn on this side
+static void push_net_event(const NetEvent &event)
+{
+  if (flush_deferred_net_events() && netEvents.push(event))
+    return;
+  if (event.type != E_NET_INPUT && event.type != E_NET_SNAPSHOT_ACK)
+    deferredNetEvents.push_back(event);
 }
 
+// network thread, decodes everything right away so the simulation never touches ENet
 static void update_net(ENetHost* server)
 {
   ENetEvent event;
   while (enet_host_service(server, &event, 0) > 0)
   {
+    NetEvent netEvent = {};
+    netEvent.peerIdx = uint16_t(event.peer - server->peers);
     switch (event.type)
     {
     case ENET_EVENT_TYPE_CONNECT:
       printf("Connection with %x:%u established\n", event.peer->address.host, event.peer->address.port);
+      netEvent.type = E_NET_CONNECT;
+      netEvent.incomingBandwidth = event.peer->incomingBandwidth;
+      netEvent.connectID = event.peer->connectID;
+      break;
+    case ENET_EVENT_TYPE_DISCONNECT:
+      netEvent.type = E_NET_DISCONNECT;
       break;
     case ENET_EVENT_TYPE_RECEIVE:
       switch (get_packet_type(event.packet))
       {
         case E_CLIENT_TO_SERVER_JOIN:
-          on_join(event.packet, event.peer, server);
+          netEvent.type = E_NET_JOIN;
           break;
         case E_CLIENT_TO_SERVER_INPUT:
-          on_input(event.packet);
+          netEvent.type = E_NET_INPUT;
+          deserialize_entity_input(event.packet, netEvent.eid, netEvent.seq, netEvent.thr, netEvent.steer);
+          break;
+        case E_CLIENT_TO_SERVER_SNAPSHOT_ACK:
+          netEvent.type = E_NET_SNAPSHOT_ACK;
+          deserialize_snapshot_ack(event.packet, netEvent.seq);
           break;
+        case E_CLIENT_TO_SERVER_LOCKSTEP_RESYNC:
+          netEvent.type = E_NET_LOCKSTEP_RESYNC;
+          break;
+        default:
+          enet_packet_destroy(event.packet);
+          continue;
       };
       enet_packet_destroy(event.packet);
       break;
     default:
-      break;
+      continue;
     };
+    push_net_event(netEvent);
+  }
+}
+
+// network thread, hands the packets the simulation encoded over to ENet
+static void send_outgoing(ENetHost* server)
+{
+  OutgoingPacket out;
+  while (outgoingPackets.pop(out))
+  {
+    ENetPeer *peer = &server->peers[out.peerIdx];
+    if (peer->state == ENET_PEER_STATE_CONNECTED && peer->connectID == out.connectID)
+      enet_peer_send(peer, out.channel, out.packet);
+    // drops the simulation's reference, see queue_outgoing
+    if (out.last && --out.packet->referenceCount == 0)
+      enet_packet_destroy(out.packet);
+  }
+}
+
+// simulation thread, the network thread drains the queue on its own schedule
+static bool flush_deferred_packets()
+{
+  while (!deferredPackets.empty() && outgoingPackets.push(deferredPackets.front()))
+    deferredPackets.pop_front();
+  return deferredPackets.empty();
+}
+
+// simulation thread packet sink. A packet shared by several peers could be sent,
+// acked and freed by ENet before its later entries leave the queue, so the
+// simulation holds a reference from its first entry until the network thread
+// has handed over the last one. The count is only touched by the simulation
+// before the packet is pushed and by the network thread after.
+static void queue_outgoing(void *, ENetPeer *peer, uint8_t channel, ENetPacket *packet, bool last)
+{
+  static ENetPacket *heldPacket = nullptr;
+  if (packet != heldPacket)
+  {
+    ++packet->referenceCount;
+    heldPacket = packet;
+  }
+  if (last)
+    heldPacket = nullptr;
+  const uint16_t peerIdx = uint16_t(peer - hostPeers);
+  const OutgoingPacket out = {packet, peerStates[peerIdx].connectID, peerIdx, channel, last};
+  if (flush_deferred_packets() && outgoingPackets.push(out))
+    return;
+  deferredPackets.push_back(out);
+}
+
+static void apply_net_event(const NetEvent &event, uint32_t tick)
+{
+  switch (event.type)
+  {
+  case E_NET_CONNECT:
+    peerStates[event.peerIdx] = PeerState();
+    peerStates[event.peerIdx].connected = true;
+    peerStates[event.peerIdx].incomingBandwidth = event.incomingBandwidth;
+    peerStates[event.peerIdx].connectID = event.connectID;
+    break;
+  case E_NET_DISCONNECT:
+    on_leave(event.peerIdx, tick);
+    break;
+  case E_NET_JOIN:
+    on_join(&hostPeers[event.peerIdx], tick);
+    break;
+  case E_NET_INPUT:
+    on_input(event);
+    break;
+  case E_NET_SNAPSHOT_ACK:
+    on_snapshot_ack(event);
+    break;
+  case E_NET_LOCKSTEP_RESYNC:
+    // gets the whole world again after the next frame
+    peerStates[event.peerIdx].lockstepSynced = false;
+    break;
+  };
+}
+
+static void process_net_events(uint32_t tick)
+{
+  NetEvent event;
+  while (netEvents.pop(event))
+  {
+    journal.append(to_journal_record(tick, event));
+    apply_net_event(event, tick);
   }
 }
 
-static void update_ai(Entity& e, float dt)
+struct PendingSpawn
 {
-  // small random chance to enable or disable throttle
-  if (rand() % 100 == 0)
-    e.thr = e.thr > 0.f ? 0.f : 1.f;
-  // small random chance to enable or disable steering
-  if (rand() % 10 == 0)
-    e.steer = e.steer != 0.f ? 0.f : ((rand() % 2) * 2.f - 1.f);
+  uint32_t idx;
+  ENetPeer *peer;
+};
+static std::vector<PendingSpawn> pendingSpawns;
+
+// an entity often enters several areas at once (spawns, ships flying in
+// formation), encode each spawn once and share the packet between its peers
+static void flush_spawns()
+{
+  static std::vector<ENetPeer*> peers;
+  std::sort(pendingSpawns.begin(), pendingSpawns.end(),
+            [](const PendingSpawn &a, const PendingSpawn &b) { return a.idx < b.idx; });
+  for (size_t i = 0; i < pendingSpawns.size();)
+  {
+    peers.clear();
+    size_t end = i;
+    for (; end < pendingSpawns.size() && pendingSpawns[end].idx == pendingSpawns[i].idx; ++end)
+      peers.push_back(pendingSpawns[end].peer);
+    send_new_entity(peers.data(), peers.size(), entities.get(pendingSpawns[i].idx));
+    i = end;
+  }
+  pendingSpawns.clear();
+}
+
+// tells the client about entities entering and leaving its area of interest,
+// returns the number of bytes this cost
+static size_t update_interest(ENetPeer *peer, PeerState &state,
+                              const std::vector<uint32_t> &visibleIdx)
+{
+  static std::vector<uint16_t> visible;
+  static std::vector<float> priority;
+  visible.clear();
+  priority.clear();
+  size_t bytes = 0;
+  size_t oldIdx = 0;
+  auto remove = [&]()
+  {
+    send_remove_entity(peer, state.visible[oldIdx++]);
+    bytes += sizeof(uint8_t) + sizeof(uint16_t) + packetOverheadBytes;
+  };
+  for (uint32_t idx : visibleIdx)
+  {
+    const uint16_t eid = entities.eid[idx];
+    while (oldIdx < state.visible.size() && state.visible[oldIdx] < eid)
+      remove();
+    if (oldIdx < state.visible.size() && state.visible[oldIdx] == eid)
+      priority.push_back(state.priority[oldIdx++]);
+    else
+    {
+      // spawn carries the full state, no need to rush the first snapshot
+      pendingSpawns.push_back({idx, peer});
+      bytes += sizeof(uint8_t) + sizeof(Entity) + packetOverheadBytes;
+      priority.push_back(0.f);
+    }
+    visible.push_back(eid);
+  }
+  while (oldIdx < state.visible.size())
+    remove();
+  state.visible.swap(visible);
+  state.priority.swap(priority);
+  return bytes;
 }
 
-static void simulate_world(ENetHost* server, float dt)
+static void accumulate_priority(PeerState &state, const std::vector<uint32_t> &visibleIdx,
+                                float dt)
 {
-  for (Entity &e : entities)
+  constexpr float nearWeight = 4.f;
+  if (state.controlledIdx == no_entity_index)
+    return;
+  const float ctrlX = entities.x[state.controlledIdx];
+  const float ctrlY = entities.y[state.controlledIdx];
+  for (size_t i = 0; i < visibleIdx.size(); ++i)
   {
-    if (e.serverControlled)
-      update_ai(e, dt);
-    // simulate
-    simulate_entity(e, dt);
-    // send
-    for (size_t i = 0; i < server->peerCount; ++i)
+    const float dx = wrap_delta(entities.x[visibleIdx[i]] - ctrlX, worldSize);
+    const float dy = wrap_delta(entities.y[visibleIdx[i]] - ctrlY, worldSize);
+    const float closeness = 1.f - clamp(sqrtf(dx * dx + dy * dy) / interestRadius, 0.f, 1.f);
+    state.priority[i] += (1.f + nearWeight * closeness) * dt;
+  }
+}
+
+static void send_snapshots(float dt, uint32_t server_time)
+{
+  interestGrid.rebuild(entities);
+  // every player's ship is a direct lookup
+  for (PeerState &state : peerStates)
+  {
+    const uint32_t idx = entities.find(state.controlled);
+    state.controlledIdx = idx == EntityRegistry::npos ? no_entity_index : idx;
+  }
+
+  static std::vector<uint32_t> visibleIdx;
+  static std::vector<EntityRecord> records;
+  for (size_t i = 0; i < peerStates.size(); ++i)
+  {
+    PeerState &state = peerStates[i];
+    if (!state.connected)
+      continue;
+    ENetPeer *peer = &hostPeers[i];
+
+    visibleIdx.clear();
+    if (state.controlledIdx != no_entity_index)
+    {
+      interestGrid.query(entities.x[state.controlledIdx], entities.y[state.controlledIdx], interestRadius,
+                         [&](uint32_t idx) { visibleIdx.push_back(idx); });
+    }
+    std::sort(visibleIdx.begin(), visibleIdx.end(),
+              [](uint32_t a, uint32_t b) { return entities.eid[a] < entities.eid[b]; });
+
+    // honour what the client says it can take, allow at most a couple of packets of burst
+    float bandwidth = peerBandwidth;
+    if (state.incomingBandwidth != 0)
+      bandwidth = std::min(bandwidth, float(state.incomingBandwidth));
+    state.budgetBytes = std::min(state.budgetBytes + bandwidth * dt, 2.f * maxSnapshotPacketSize);
+    state.budgetBytes -= update_interest(peer, state, visibleIdx);
+    accumulate_priority(state, visibleIdx, dt);
+    if (state.budgetBytes <= packetOverheadBytes)
+      continue; // starved this tick, priorities keep growing
+
+    // one delta-compressed snapshot against the newest frame the peer acked
+    const SnapshotFrame *baseline = nullptr;
+    if (state.hasAck && uint16_t(state.nextSeq - state.ackedSeq) < snapshotHistorySize)
+      baseline = state.history.find(state.ackedSeq);
+    SnapshotFrame &sent = state.history.push(state.nextSeq++);
+    sent.serverTime = server_time;
+    float packetBudget = std::min(state.budgetBytes, float(maxSnapshotPacketSize)) - packetOverheadBytes;
+    if (state.controlledIdx != no_entity_index)
     {
-      ENetPeer *peer = &server->peers[i];
-      // skip this here in this implementation
-      //if (controlledMap[e.eid] != peer)
-      send_snapshot(peer, e.eid, e.x, e.y, e.ori);
+      const Entity ctrl = entities.get(state.controlledIdx);
+      sent.hasControlled = true;
+      sent.controlled = {state.lastInputSeq, ctrl.x, ctrl.y, ctrl.vx, ctrl.vy, ctrl.ori, ctrl.omega};
+      packetBudget -= sizeof(ControlledState);
     }
+    schedule_snapshot(entities, baseline, server_time, visibleIdx, state.controlledIdx, deadReckoning, packetBudget,
+                      records, state.priority);
+    size_t bytes = send_world_snapshot(peer, baseline, records, sent);
+    state.budgetBytes -= bytes + packetOverheadBytes;
+  }
+  flush_spawns();
+}
+
+// 1024 floats per array, chunks never share a cache line
+constexpr size_t simulationChunk = 1024;
+
+static void simulate_world(JobSystem &jobs, float dt, uint32_t tick)
+{
+  // every ship only touches its own state, all done before anything is encoded
+  jobs.parallel_for(entities.size(), simulationChunk, [&](size_t first, size_t count)
+  {
+    update_ai(entities, first, count, tick, worldSeed);
+    simulate_entities(entities, first, count, dt);
+  });
+  entityHistory.record(tick, entities);
+}
+
+// lockstep tick: collect what changed into the frame, simulate it, send it to the
+// peers that have the world and the world to the peers that don't
+static void step_lockstep()
+{
+  for (const PeerState &state : peerStates)
+  {
+    if (state.lockstepShip == invalid_entity)
+      continue;
+    // a ship spawned by this very frame starts with its controls released
+    const uint32_t idx = lockstepWorld.registry.find_eid(state.lockstepShip);
+    const int8_t thr = idx != EntityRegistry::npos ? lockstepWorld.entities[idx].thr : 0;
+    const int8_t steer = idx != EntityRegistry::npos ? lockstepWorld.entities[idx].steer : 0;
+    if (state.lockstepThr != thr || state.lockstepSteer != steer)
+      lockstepFrame.inputs.push_back({state.lockstepShip, state.lockstepThr, state.lockstepSteer});
+  }
+  lockstepFrame.tick = lockstepWorld.tick + 1;
+  lockstepWorld.step(lockstepFrame);
+  lockstepFrame.hasChecksum = lockstepFrame.tick % lockstepChecksumInterval == 0;
+  if (lockstepFrame.hasChecksum)
+    lockstepFrame.checksum = lockstepWorld.checksum();
+
+  static std::vector<ENetPeer*> syncedPeers;
+  syncedPeers.clear();
+  for (size_t i = 0; i < peerStates.size(); ++i)
+    if (peerStates[i].connected && peerStates[i].lockstepSynced)
+      syncedPeers.push_back(&hostPeers[i]);
+  send_lockstep_frame(syncedPeers.data(), syncedPeers.size(), lockstepFrame);
+  for (size_t i = 0; i < peerStates.size(); ++i)
+  {
+    PeerState &state = peerStates[i];
+    if (!state.connected || state.lockstepSynced || state.lockstepShip == invalid_entity)
+      continue;
+    send_lockstep_state(&hostPeers[i], lockstepWorld);
+    state.lockstepSynced = true;
   }
+  lockstepFrame.clear();
 }
 
 static void update_time(ENetHost* server, uint32_t curTime)
 {
   // We can send it less often too
-  for (size_t i = 0; i < server->peerCount; ++i)
-    send_time_msec(&server->peers[i], curTime);
+  broadcast_time_msec(server, curTime);
 }
 
-int main(int argc, const char **argv)
+static float get_arg(int argc, const char **argv, const char *name, float default_val)
+{
+  for (int i = 1; i + 1 < argc; ++i)
+    if (strcmp(argv[i], name) == 0)
+      return atof(argv[i + 1]);
+  return default_val;
+}
+
+// 64-bit values don't survive the float of get_arg
+static uint64_t get_seed(int argc, const char **argv)
+{
+  for (int i = 1; i + 1 < argc; ++i)
+    if (strcmp(argv[i], "--seed") == 0)
+      return strtoull(argv[i + 1], nullptr, 0);
+  std::random_device rd;
+  return uint64_t(rd()) << 32 | rd();
+}
+
+static const char *get_string_arg(int argc, const char **argv, const char *name)
+{
+  for (int i = 1; i + 1 < argc; ++i)
+    if (strcmp(argv[i], name) == 0)
+      return argv[i + 1];
+  return nullptr;
+}
+
+static bool has_flag(int argc, const char **argv, const char *name)
+{
+  for (int i = 1; i < argc; ++i)
+    if (strcmp(argv[i], name) == 0)
+      return true;
+  return false;
+}
+
+// once a second, how much general heap traffic the ticks caused
+static void report_allocations(uint32_t curTime, uint32_t ticks_done)
+{
+  static uint32_t lastReportTime = curTime;
+  static AllocatorStats lastStats = get_allocator_stats();
+  static uint32_t ticks = 0;
+  ticks += ticks_done;
+  if (curTime - lastReportTime < 1000)
+    return;
+  const AllocatorStats &stats = get_allocator_stats();
+  printf("alloc: %u ticks, pool heap %llu allocs %llu frees, new %llu delete %llu, pool %.1f allocs/tick, "
+         "%zu bytes in use, %zu reserved\n",
+         ticks, (unsigned long long)(stats.heapAllocs - lastStats.heapAllocs),
+         (unsigned long long)(stats.heapFrees - lastStats.heapFrees),
+         (unsigned long long)(stats.newCalls - lastStats.newCalls),
+         (unsigned long long)(stats.deleteCalls - lastStats.deleteCalls),
+         ticks ? double(stats.poolAllocs - lastStats.poolAllocs) / ticks : 0.0, stats.bytesInUse, stats.bytesReserved);
+  lastStats = stats;
+  lastReportTime = curTime;
+  ticks = 0;
+}
+
+// once a second, how the ticks fit into their time budget
+static void report_ticks(FixedTimestep &timestep, uint32_t curTime)
+{
+  static uint32_t lastReportTime = curTime;
+  if (curTime - lastReportTime < 1000)
+    return;
+  const TickStats &stats = timestep.stats;
+  printf("ticks: %u, work avg %.3f ms max %.3f ms of %.3f ms, %u overruns, %u dropped\n",
+         stats.ticks, stats.ticks ? stats.totalWorkNsec * 1e-6 / stats.ticks : 0.0,
+         stats.maxWorkNsec * 1e-6, timestep.tickNsec * 1e-6, stats.overruns, stats.droppedTicks);
+  timestep.stats = TickStats();
+  lastReportTime = curTime;
+}
+
+// one tick of the world, true if it left packets for the network thread
+static bool run_tick(JobSystem &jobs, const FixedTimestep &timestep, uint32_t snapshot_interval)
+{
+  if (lockstep)
+  {
+    step_lockstep();
+    return true;
+  }
+  simulate_world(jobs, timestep.dt(), timestep.tick);
+  if (timestep.tick % snapshot_interval != 0)
+    return false;
+  send_snapshots(timestep.dt() * snapshot_interval, timestep.time_msec());
+  return true;
+}
+
+// simulation thread, never touches the ENetHost
+static void run_simulation(float tick_rate, uint32_t snapshot_interval, size_t num_threads, EventLoop &net_loop,
+                           bool alloc_stats, bool tick_stats)
+{
+  packetSink = {queue_outgoing, nullptr};
+  JobSystem jobs(num_threads);
+  FixedTimestep timestep(tick_rate);
+  while (true)
+  {
+    get_frame_arena().reset();
+
+    process_net_events(timestep.tick);
+    const uint32_t due = timestep.advance();
+    for (uint32_t i = 0; i < due; ++i)
+    {
+      const uint64_t tickStart = get_time_nsec();
+      // inputs that arrived while catching up still count for the next tick
+      process_net_events(timestep.tick);
+      if (run_tick(jobs, timestep, snapshot_interval))
+        net_loop.notify();
+      timestep.end_tick(get_time_nsec() - tickStart);
+    }
+    journal.flush();
+    if (!deferredPackets.empty())
+    {
+      flush_deferred_packets();
+      net_loop.notify();
+    }
+
+    const uint32_t curTime = enet_time_get();
+    if (alloc_stats)
+      report_allocations(curTime, due);
+    if (tick_stats)
+      report_ticks(timestep, curTime);
+    // inputs wait in the queue until the tick, nothing to wake up for early
+    std::this_thread::sleep_for(std::chrono::nanoseconds(timestep.time_to_next_tick()));
+  }
+}
+
+struct ServerOptions
+{
+  float tickRate;
+  float snapshotRate;
+  // snapshots go out every n-th tick
+  uint32_t snapshotInterval;
+  size_t numThreads;
+  bool allocStats;
+  bool tickStats;
+};
+
+// everything that changes what the simulation does comes from here, the replay
+// runs the recorded command line through it again
+static ServerOptions configure(int argc, const char **argv)
+{
+  interestRadius = get_arg(argc, argv, "--aoi-radius", interestRadius);
+  interestGrid = InterestGrid(worldSize, interestRadius);
+  peerBandwidth = get_arg(argc, argv, "--peer-bandwidth", peerBandwidth);
+  deadReckoning.error = get_arg(argc, argv, "--dr-error", deadReckoning.error);
+  // clients stop extrapolating not long after the default
+  deadReckoning.age = std::min<uint32_t>(get_arg(argc, argv, "--dr-max-age", deadReckoning.age), deadReckoningMaxAge);
+  lockstep = has_flag(argc, argv, "--lockstep");
+
+  ServerOptions options;
+  options.tickRate = get_arg(argc, argv, "--tick-rate", 60.f);
+  options.snapshotRate = get_arg(argc, argv, "--snapshot-rate", 20.f);
+  options.snapshotInterval = std::max(1, int(roundf(options.tickRate / options.snapshotRate)));
+  // a freed eid sits out until the lag compensation history and every snapshot
+  // baseline that could mention it are gone, and late inputs have long arrived
+  eidAllocator.reuseDelay = std::max({uint32_t(lagCompensationTicks),
+                                      uint32_t(snapshotHistorySize) * options.snapshotInterval,
+                                      uint32_t(options.tickRate * 2.f)});
+
+  options.allocStats = has_flag(argc, argv, "--alloc-stats");
+  options.tickStats = has_flag(argc, argv, "--tick-stats");
+  // simulation threads, by default every core but the network thread's
+  options.numThreads = std::max(1, int(get_arg(argc, argv, "--threads",
+                                               float(std::thread::hardware_concurrency()) - 1.f)));
+  return options;
+}
+
+static void create_world(uint64_t seed, float tick_rate)
+{
+  worldSeed = seed;
+  spawnRng = Rng(worldSeed, 0xffffffffu);
+  if (lockstep)
+    lockstepWorld.reset(worldSeed, 0, lockstep_dt(uint32_t(roundf(tick_rate))));
+
+  constexpr size_t numShips = 100;
+  for (size_t i = 0; i < numShips; ++i)
+    create_server_entity(0);
+}
+
+int server_main(int argc, const char **argv)
 {
-  if (enet_initialize() != 0)
+  const ServerOptions options = configure(argc, argv);
+
+  // all ENet packets and commands come from the size-class pools
+  ENetCallbacks callbacks = {pool_malloc, pool_free, nullptr};
+  if (enet_initialize_with_callbacks(ENET_VERSION, &callbacks) != 0)
   {
     printf("Cannot init ENet");
     return 1;
@@ -151,30 +814,58 @@ int main(int argc, const char **argv)
   address.host = ENET_HOST_ANY;
   address.port = 10131;
 
-  ENetHost *server = enet_host_create(&address, 32, 2, 0, 0);
+  // raise for w7_loadgen, a host can't have more than ENET_PROTOCOL_MAXIMUM_PEER_ID
+  const size_t maxPeers = std::clamp(int(get_arg(argc, argv, "--max-peers", 32.f)), 1, ENET_PROTOCOL_MAXIMUM_PEER_ID);
+  ENetHost *server = enet_host_create(&address, maxPeers, 2, 0, 0);
 
   if (!server)
   {
     printf("Cannot create ENet server\n");
     return 1;
   }
+  peerStates.resize(server->peerCount);
 
-  constexpr size_t numShips = 100;
-  for (size_t i = 0; i < numShips; ++i)
-    create_server_entity(server);
+  const uint64_t seed = get_seed(argc, argv);
+  printf("World seed %llu\n", (unsigned long long)seed);
+  create_world(seed, options.tickRate);
 
-  uint32_t lastTime = enet_time_get();
-  while (true)
+  if (const char *journalPath = get_string_arg(argc, argv, "--journal"))
   {
-    uint32_t curTime = enet_time_get();
-    float dt = (curTime - lastTime) * 0.001f;
-    lastTime = curTime;
+    JournalHeader header;
+    header.seed = seed;
+    header.tickRate = options.tickRate;
+    header.peerCount = uint32_t(server->peerCount);
+    if (!journal.open(journalPath, header, argc, argv))
+      printf("Cannot create journal %s\n", journalPath);
+  }
+
+  hostPeers = server->peers;
+  EventLoop eventLoop(server);
+  std::thread simThread(run_simulation, options.tickRate, options.snapshotInterval, options.numThreads,
+                        std::ref(eventLoop), options.allocStats, options.tickStats);
 
+  // the main thread is the network thread, a connection storm only ever stalls
+  // this loop, the simulation keeps ticking on its own
+  const uint32_t timeInterval = uint32_t(1000.f / options.snapshotRate);
+  uint32_t lastTimeBroadcast = enet_time_get();
+  while (true)
+  {
     update_net(server);
-    simulate_world(server, dt);
-    update_time(server, curTime);
-    usleep(10000);
+    send_outgoing(server);
+    const uint32_t curTime = enet_time_get();
+    if (curTime - lastTimeBroadcast >= timeInterval)
+    {
+      update_time(server, curTime);
+      lastTimeBroadcast = curTime;
+    }
+    // don't leave the snapshots waiting for the next service call
+    enet_host_flush(server);
+    // without a notification the outgoing queue has to be polled, deferred events
+    // go as soon as the simulation makes room
+    flush_deferred_net_events();
+    eventLoop.wait(eventLoop.has_notify() && deferredNetEvents.empty() ? 10000000 : 1000000);
   }
+  simThread.join();
 
   enet_host_destroy(server);
 
@@ -183,3 +874,87 @@ int main(int argc, const char **argv)
 }
 
 
+
+// replayed packets go nowhere, only their size is counted
+static void discard_packet(void *user, ENetPeer *, uint8_t, ENetPacket *packet, bool last)
+{
+  *(size_t*)user += packet->dataLength;
+  if (last && packet->referenceCount == 0)
+    enet_packet_destroy(packet);
+}
+
+// Runs a journal through the simulation as fast as it goes, with the recorded
+// command line and seed, and times every tick. Peers are never touched beyond
+// their address, so a zeroed array stands in for the host's.
+// usage: w7_replay <journal> [--threads n] [--per-tick]
+int replay_main(int argc, const char **argv)
+{
+  JournalReader reader;
+  if (argc < 2 || !reader.open(argv[1]))
+  {
+    printf("usage: w7_replay <journal> [--threads n] [--per-tick]\n");
+    return 1;
+  }
+  const ServerOptions options = configure(int(reader.args.size()), reader.args.data());
+  const size_t numThreads = std::max(1, int(get_arg(argc, argv, "--threads",
+                                                    float(std::thread::hardware_concurrency()))));
+  const bool perTick = has_flag(argc, argv, "--per-tick");
+
+  ENetCallbacks callbacks = {pool_malloc, pool_free, nullptr};
+  if (enet_initialize_with_callbacks(ENET_VERSION, &callbacks) != 0)
+  {
+    printf("Cannot init ENet");
+    return 1;
+  }
+  std::vector<ENetPeer> peers(reader.header.peerCount);
+  hostPeers = peers.data();
+  peerStates.resize(peers.size());
+  create_world(reader.header.seed, options.tickRate);
+
+  size_t bytesSent = 0;
+  packetSink = {discard_packet, &bytesSent};
+  JobSystem jobs(numThreads);
+  FixedTimestep timestep(options.tickRate);
+  const uint32_t lastTick = reader.count > 0 ? reader.records[reader.count - 1].tick : 0;
+  std::vector<uint64_t> tickNsec;
+  tickNsec.reserve(lastTick + 1);
+  size_t next = 0;
+  if (perTick)
+    printf("tick usec bytes\n");
+  const uint64_t replayStart = get_time_nsec();
+  for (uint32_t tick = 0; tick <= lastTick; ++tick)
+  {
+    get_frame_arena().reset();
+    timestep.tick = tick;
+    const size_t bytesBefore = bytesSent;
+    const uint64_t tickStart = get_time_nsec();
+    for (; next < reader.count && reader.records[next].tick <= tick; ++next)
+      apply_net_event(from_journal_record(reader.records[next]), tick);
+    run_tick(jobs, timestep, options.snapshotInterval);
+    tickNsec.push_back(get_time_nsec() - tickStart);
+    if (perTick)
+      printf("%u %.1f %zu\n", tick, tickNsec.back() * 1e-3, bytesSent - bytesBefore);
+  }
+  const double totalMsec = (get_time_nsec() - replayStart) * 1e-6;
+
+  std::vector<uint64_t> sorted = tickNsec;
+  std::sort(sorted.begin(), sorted.end());
+  const size_t worst = std::max_element(tickNsec.begin(), tickNsec.end()) - tickNsec.begin();
+  auto percentile = [&](double p) { return sorted[std::min(sorted.size() - 1, size_t(p * sorted.size()))] * 1e-3; };
+  printf("%zu events, %zu ticks in %.1f ms (%.1fx real time) on %zu threads, %zu bytes sent\n",
+         reader.count, tickNsec.size(), totalMsec, tickNsec.size() / options.tickRate * 1e3 / totalMsec,
+         numThreads, bytesSent);
+  printf("tick usec: p50 %.1f p90 %.1f p99 %.1f max %.1f (tick %zu)\n",
+         percentile(0.5), percentile(0.9), percentile(0.99), sorted.back() * 1e-3, worst);
+  enet_deinitialize();
+  return 0;
+}
+
+int main(int argc, const char **argv)
+{
+#ifdef W7_REPLAY
+  return replay_main(argc, argv);
+#else
+  return server_main(argc, argv);
+#endif
+}
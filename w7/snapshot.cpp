@@ -0,0 +1,64 @@
+#include "snapshot.h"
+#include "quantisation.h"
+#include <algorithm>
+
+EntityRecord pack_entity_record(const Entity &ent, uint32_t time)
+{
+  EntityRecord rec;
+  rec.eid = ent.eid;
+  rec.x = PositionXQuantized(ent.x, -worldSize, worldSize).packedVal;
+  rec.y = PositionYQuantized(ent.y, -worldSize, worldSize).packedVal;
+  rec.ori = OrientationQuantized(ent.ori, -PI, PI).packedVal;
+  rec.vx = VelocityQuantized(ent.vx, -maxEntitySpeed, maxEntitySpeed).packedVal;
+  rec.vy = VelocityQuantized(ent.vy, -maxEntitySpeed, maxEntitySpeed).packedVal;
+  rec.omega = AngularVelocityQuantized(ent.omega, -maxEntityAngularSpeed, maxEntityAngularSpeed).packedVal;
+  rec.time = time;
+  return rec;
+}
+
+void unpack_entity_record(const EntityRecord &rec, float &x, float &y, float &ori)
+{
+  x = PositionXQuantized(rec.x).unpack(-worldSize, worldSize);
+  y = PositionYQuantized(rec.y).unpack(-worldSize, worldSize);
+  ori = OrientationQuantized(rec.ori).unpack(-PI, PI);
+}
+
+void unpack_entity_velocity(const EntityRecord &rec, float &vx, float &vy, float &omega)
+{
+  vx = VelocityQuantized(rec.vx).unpack(-maxEntitySpeed, maxEntitySpeed);
+  vy = VelocityQuantized(rec.vy).unpack(-maxEntitySpeed, maxEntitySpeed);
+  omega = AngularVelocityQuantized(rec.omega).unpack(-maxEntityAngularSpeed, maxEntityAngularSpeed);
+}
+
+void extrapolate_entity_record(const EntityRecord &rec, uint32_t time, float &x, float &y, float &ori)
+{
+  float vx, vy, omega;
+  unpack_entity_record(rec, x, y, ori);
+  unpack_entity_velocity(rec, vx, vy, omega);
+  const float dt = std::clamp(int32_t(time - rec.time), 0, int32_t(deadReckoningMaxAge)) * 0.001f;
+  x = wrap_delta(x + vx * dt, worldSize);
+  y = wrap_delta(y + vy * dt, worldSize);
+  ori = wrap_delta(ori + omega * dt, PI);
+}
+
+SnapshotFrame &SnapshotHistory::push(uint16_t seq)
+{
+  SnapshotFrame &frame = frames[seq % snapshotHistorySize];
+  frame.seq = seq;
+  frame.valid = true;
+  frame.records.clear(); // keeps capacity, so steady state doesn't allocate
+  frame.hasControlled = false;
+  return frame;
+}
+
+const SnapshotFrame *SnapshotHistory::find(uint16_t seq) const
+{
+  const SnapshotFrame &frame = frames[seq % snapshotHistorySize];
+  return frame.valid && frame.seq == seq ? &frame : nullptr;
+}
+
+void SnapshotHistory::reset()
+{
+  for (SnapshotFrame &frame : frames)
+    frame.valid = false;
+}
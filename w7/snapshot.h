@@ -0,0 +1,81 @@
+#pragma once
+#include <cstdint>
+#include <array>
+#include <vector>
+#include "entity.h"
+
+// velocities are clamped to these for quantisation
+constexpr float maxEntitySpeed = 32.f;
+constexpr float maxEntityAngularSpeed = 4.f;
+// dead reckoning, the longest a client coasts an entity on its last known
+// velocity before the server refreshes it no matter what, msec
+constexpr uint32_t deadReckoningMaxAge = 1000;
+
+// quantised entity state exactly as it is seen by the client
+struct EntityRecord
+{
+  uint16_t eid = invalid_entity;
+  uint16_t x = 0;
+  uint16_t y = 0;
+  uint8_t ori = 0;
+  uint16_t vx = 0;
+  uint16_t vy = 0;
+  uint16_t omega = 0;
+  // server msec the state was sampled at, never sent, both sides derive it
+  // from the snapshot the record last changed in
+  uint32_t time = 0;
+
+  // same state, regardless of when it was sampled
+  bool operator==(const EntityRecord &rhs) const
+  {
+    return eid == rhs.eid && x == rhs.x && y == rhs.y && ori == rhs.ori &&
+           vx == rhs.vx && vy == rhs.vy && omega == rhs.omega;
+  }
+};
+
+EntityRecord pack_entity_record(const Entity &ent, uint32_t time);
+void unpack_entity_record(const EntityRecord &rec, float &x, float &y, float &ori);
+void unpack_entity_velocity(const EntityRecord &rec, float &vx, float &vy, float &omega);
+// where the client will show the entity at `time` if it hears nothing new
+void extrapolate_entity_record(const EntityRecord &rec, uint32_t time, float &x, float &y, float &ori);
+
+// full precision state of the receiving peer's own ship, the client predicts
+// it locally and needs an exact starting point to replay its inputs from
+struct ControlledState
+{
+  uint16_t inputSeq = 0; // last input the server applied
+  float x = 0.f;
+  float y = 0.f;
+  float vx = 0.f;
+  float vy = 0.f;
+  float ori = 0.f;
+  float omega = 0.f;
+};
+
+struct SnapshotFrame
+{
+  uint16_t seq = 0;
+  bool valid = false;
+  uint32_t serverTime = 0; // msec, when the server took the snapshot
+  std::vector<EntityRecord> records; // sorted by eid
+  bool hasControlled = false;
+  ControlledState controlled;
+};
+
+// sequence numbers wrap around, so compare them modulo 2^16
+inline bool seq_greater(uint16_t a, uint16_t b)
+{
+  return int16_t(a - b) > 0;
+}
+
+constexpr uint16_t snapshotHistorySize = 32;
+
+// ring of the last snapshotHistorySize frames, addressed by sequence number
+struct SnapshotHistory
+{
+  std::array<SnapshotFrame, snapshotHistorySize> frames;
+
+  SnapshotFrame &push(uint16_t seq);
+  const SnapshotFrame *find(uint16_t seq) const;
+  void reset();
+};
@@ -0,0 +1,88 @@
+#include "snapshotScheduler.h"
+#include "protocol.h"
+#include "mathUtils.h"
+#include <algorithm>
+
+bool dead_reckoning_expired(const EntityRecord &base, const Entity &e, uint32_t server_time,
+                            const DeadReckoningLimits &limits)
+{
+  if (server_time - base.time >= limits.age)
+    return true;
+  float x, y, ori;
+  extrapolate_entity_record(base, server_time, x, y, ori);
+  const float dx = wrap_delta(e.x - x, worldSize);
+  const float dy = wrap_delta(e.y - y, worldSize);
+  return dx * dx + dy * dy > limits.error * limits.error ||
+         fabsf(wrap_delta(e.ori - ori, PI)) > limits.angleError;
+}
+
+struct SnapshotCandidate
+{
+  uint32_t idx;
+  size_t visibleIdx;
+  EntityRecord rec;
+  const EntityRecord *base;
+  size_t bits;
+};
+
+// Priority accumulator: every visible entity gains priority each tick (more when
+// close) and the highest priority changes are packed until the peer's byte budget
+// runs out. Whatever is not picked keeps the baseline state the client already
+// has and costs a single bit. The peer's own ship travels separately in full
+// precision, so it is left out.
+void schedule_snapshot(const EntityStore &entities, const SnapshotFrame *baseline, uint32_t server_time,
+                       const std::vector<uint32_t> &visible_idx, size_t controlled_idx,
+                       const DeadReckoningLimits &limits, float budget_bytes,
+                       std::vector<EntityRecord> &records, std::vector<float> &priority)
+{
+  static thread_local std::vector<SnapshotCandidate> candidates;
+  candidates.clear();
+  records.clear();
+  float budgetBits = budget_bytes * 8.f;
+  size_t baseIdx = 0;
+  for (size_t i = 0; i < visible_idx.size(); ++i)
+  {
+    if (visible_idx[i] == controlled_idx)
+      continue;
+    const Entity e = entities.get(visible_idx[i]);
+    const EntityRecord rec = pack_entity_record(e, server_time);
+    const EntityRecord *base = nullptr;
+    if (baseline)
+    {
+      const std::vector<EntityRecord> &baseRecs = baseline->records;
+      while (baseIdx < baseRecs.size() && baseRecs[baseIdx].eid < rec.eid)
+        ++baseIdx;
+      if (baseIdx < baseRecs.size() && baseRecs[baseIdx].eid == rec.eid)
+        base = &baseRecs[baseIdx];
+    }
+    if (base && !dead_reckoning_expired(*base, e, server_time, limits))
+    {
+      // the client's extrapolation is still good enough, it keeps the baseline
+      records.push_back(*base);
+      priority[i] = 0.f;
+      budgetBits -= 1.f;
+      continue;
+    }
+    candidates.push_back({visible_idx[i], i, rec, base, snapshot_record_bits(rec, base)});
+  }
+
+  std::sort(candidates.begin(), candidates.end(),
+            [&](const SnapshotCandidate &a, const SnapshotCandidate &b)
+            { return priority[a.visibleIdx] > priority[b.visibleIdx]; });
+  for (const SnapshotCandidate &cand : candidates)
+  {
+    if (cand.bits <= budgetBits)
+    {
+      records.push_back(cand.rec);
+      priority[cand.visibleIdx] = 0.f;
+      budgetBits -= cand.bits;
+    }
+    else if (cand.base && budgetBits >= 1.f)
+    {
+      records.push_back(*cand.base);
+      budgetBits -= 1.f;
+    }
+  }
+  std::sort(records.begin(), records.end(),
+            [](const EntityRecord &a, const EntityRecord &b) { return a.eid < b.eid; });
+}
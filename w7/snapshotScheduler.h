@@ -0,0 +1,27 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "entityStore.h"
+#include "snapshot.h"
+
+// An entity is only resent once the position the client extrapolates is this
+// far off, or the record gets too old.
+struct DeadReckoningLimits
+{
+  float error = 0.5f;
+  float angleError = 0.1f;
+  uint32_t age = deadReckoningMaxAge; // msec
+};
+
+// true once the client's extrapolation from `base` has drifted too far from `e`
+bool dead_reckoning_expired(const EntityRecord &base, const Entity &e, uint32_t server_time,
+                            const DeadReckoningLimits &limits);
+
+// Picks what goes into a peer's next world snapshot, `records` comes out sorted
+// by eid for send_world_snapshot. `priority` runs parallel to `visible_idx`,
+// picked entities are reset to 0, `controlled_idx` is skipped.
+void schedule_snapshot(const EntityStore &entities, const SnapshotFrame *baseline, uint32_t server_time,
+                       const std::vector<uint32_t> &visible_idx, size_t controlled_idx,
+                       const DeadReckoningLimits &limits, float budget_bytes,
+                       std::vector<EntityRecord> &records, std::vector<float> &priority);
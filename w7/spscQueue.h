@@ -0,0 +1,52 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+
+// Bounded single-producer single-consumer ring. One thread pushes, another one
+// pops, neither ever blocks or takes a lock. Each side only writes its own
+// index and keeps a cached copy of the other one so that the shared cache line
+// is only touched when the queue looks full (or empty).
+template<typename T, size_t capacity>
+struct SpscQueue
+{
+  static_assert((capacity & (capacity - 1)) == 0, "capacity must be a power of two");
+
+  // consumer side
+  alignas(64) std::atomic<size_t> head = 0;
+  size_t cachedTail = 0;
+  // producer side
+  alignas(64) std::atomic<size_t> tail = 0;
+  size_t cachedHead = 0;
+
+  alignas(64) T items[capacity];
+
+  // producer only, false if the queue is full
+  bool push(const T &item)
+  {
+    const size_t t = tail.load(std::memory_order_relaxed);
+    if (t - cachedHead == capacity)
+    {
+      cachedHead = head.load(std::memory_order_acquire);
+      if (t - cachedHead == capacity)
+        return false;
+    }
+    items[t & (capacity - 1)] = item;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  // consumer only, false if the queue is empty
+  bool pop(T &item)
+  {
+    const size_t h = head.load(std::memory_order_relaxed);
+    if (h == cachedTail)
+    {
+      cachedTail = tail.load(std::memory_order_acquire);
+      if (h == cachedTail)
+        return false;
+    }
+    item = items[h & (capacity - 1)];
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+};